@@ -0,0 +1,201 @@
+#ifndef BOOKSTORE_ARENA_H
+#define BOOKSTORE_ARENA_H
+
+#include <vector>
+#include <string>
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+
+// ==================== Arena ====================
+
+// Bump allocator for data that lives no longer than one command. Memory is
+// handed out from large blocks and only given back all at once by reset(),
+// which keeps the blocks for the next command, so once the blocks have
+// grown to a command's needs it allocates nothing. Not thread-safe: each
+// client has its own.
+class Arena {
+private:
+    static const size_t BLOCK_BYTES = 64 * 1024;
+    // Blocks beyond this total are freed on reset rather than kept
+    static const size_t KEEP_BYTES = 1 << 20;
+
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks;
+    size_t current; // block being bumped through
+    size_t used;    // bytes taken from it
+
+public:
+    Arena() : current(0), used(0) {}
+
+    ~Arena() {
+        for (Block& b : blocks) free(b.data);
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // `alignment` must be a power of two no larger than max_align_t's
+    void* allocate(size_t bytes, size_t alignment) {
+        while (true) {
+            if (current < blocks.size()) {
+                Block& b = blocks[current];
+                size_t start = (used + alignment - 1) & ~(alignment - 1);
+                if (start + bytes <= b.size) {
+                    used = start + bytes;
+                    return b.data + start;
+                }
+                if (current + 1 < blocks.size()) {
+                    current++;
+                    used = 0;
+                    continue;
+                }
+            }
+            size_t size = bytes > BLOCK_BYTES ? bytes : BLOCK_BYTES;
+            char* data = static_cast<char*>(malloc(size));
+            if (!data) throw std::bad_alloc();
+            blocks.push_back(Block{data, size});
+            current = blocks.size() - 1;
+            used = 0;
+        }
+    }
+
+    // Forgets everything allocated so far
+    void reset() {
+        size_t kept = 0;
+        size_t n = 0;
+        for (Block& b : blocks) {
+            if (kept + b.size <= KEEP_BYTES) {
+                kept += b.size;
+                blocks[n++] = b;
+            } else {
+                free(b.data);
+            }
+        }
+        blocks.resize(n);
+        current = 0;
+        used = 0;
+    }
+};
+
+// Standard allocator over an Arena; deallocation is a no-op
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    Arena* arena;
+
+    explicit ArenaAllocator(Arena& a) : arena(&a) {}
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template <class U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <class U>
+    bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>> ArenaString;
+
+// ==================== Node Pool ====================
+
+// Recycles freed blocks for containers whose elements come and go all the
+// time, such as map nodes and deque chunks. Sizes are rounded up to
+// GRANULE bytes and each size has its own free list, so a block freed by
+// one container is reused by the next allocation of the same size. Blocks
+// above MAX_POOLED go straight to the heap. Not thread-safe: the owner
+// serializes access.
+class NodePool {
+private:
+    static const size_t GRANULE = 16;
+    static const size_t MAX_POOLED = 4096;
+    static const size_t CLASSES = MAX_POOLED / GRANULE;
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    FreeBlock* freeLists[CLASSES];
+
+public:
+    NodePool() {
+        for (auto& head : freeLists) head = nullptr;
+    }
+
+    ~NodePool() {
+        for (auto& head : freeLists) {
+            while (head) {
+                FreeBlock* next = head->next;
+                ::operator delete(head);
+                head = next;
+            }
+        }
+    }
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    void* allocate(size_t bytes) {
+        if (bytes > MAX_POOLED) return ::operator new(bytes);
+        size_t c = (bytes + GRANULE - 1) / GRANULE - (bytes > 0);
+        if (FreeBlock* block = freeLists[c]) {
+            freeLists[c] = block->next;
+            return block;
+        }
+        return ::operator new((c + 1) * GRANULE);
+    }
+
+    void deallocate(void* p, size_t bytes) {
+        if (bytes > MAX_POOLED) {
+            ::operator delete(p);
+            return;
+        }
+        size_t c = (bytes + GRANULE - 1) / GRANULE - (bytes > 0);
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = freeLists[c];
+        freeLists[c] = block;
+    }
+};
+
+// Standard allocator over a NodePool
+template <class T>
+class PoolAllocator {
+public:
+    typedef T value_type;
+
+    NodePool* pool;
+
+    explicit PoolAllocator(NodePool& p) : pool(&p) {}
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type in a node pool");
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(pool->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        pool->deallocate(p, n * sizeof(T));
+    }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U>& other) const { return pool == other.pool; }
+    template <class U>
+    bool operator!=(const PoolAllocator<U>& other) const { return pool != other.pool; }
+};
+
+#endif
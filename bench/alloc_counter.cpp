@@ -0,0 +1,55 @@
+// Counts C++ heap allocations of the process it is preloaded into.
+//
+// The harness starts ./code with LD_PRELOAD pointing here and
+// BENCH_ALLOC_COUNTER naming an 8-byte file. Every operator new adds one
+// to the counter in that file, which the harness maps as well and reads
+// around each command.
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static std::atomic<uint64_t>* counter = nullptr;
+
+__attribute__((constructor)) static void mapCounter() {
+    const char* path = getenv("BENCH_ALLOC_COUNTER");
+    if (!path) return;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return;
+    void* p = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p != MAP_FAILED) counter = static_cast<std::atomic<uint64_t>*>(p);
+}
+
+static void* allocate(size_t size, size_t alignment, bool nothrow) {
+    if (counter) counter->fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    void* p;
+    if (alignment <= alignof(std::max_align_t)) {
+        p = malloc(size);
+    } else if (posix_memalign(&p, alignment, size) != 0) {
+        p = nullptr;
+    }
+    if (!p && !nothrow) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size) { return allocate(size, 0, false); }
+void* operator new[](size_t size) { return allocate(size, 0, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0, true); }
+void* operator new(size_t size, std::align_val_t a) { return allocate(size, (size_t)a, false); }
+void* operator new[](size_t size, std::align_val_t a) { return allocate(size, (size_t)a, false); }
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
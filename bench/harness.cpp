@@ -0,0 +1,308 @@
+// Replays a workload against the bookstore binary and reports what it cost.
+//
+//     harness BINARY WORKLOAD [ALLOC_COUNTER_LIB]
+//
+// The binary runs in a fresh directory with a pipe on stdin and stdout.
+// After every command the harness sends `show -ISBN=!sync`, a book it
+// created up front, and waits for that row: the command is done once its
+// row comes back. The cost of that query, measured on its own before the
+// replay, is taken off every sample. With ALLOC_COUNTER_LIB (see
+// alloc_counter.cpp) it also counts heap allocations per command.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+const char* const SYNC_COMMAND = "show -ISBN=!sync\n";
+const char* const SYNC_ROW = "!sync\t\t\t\t0.00\t0\n";
+const int REPLY_TIMEOUT_MS = 60000;
+const int CALIBRATION_ROUNDS = 200;
+
+typedef chrono::steady_clock Clock;
+
+[[noreturn]] void die(const string& what) {
+    cerr << "harness: " << what;
+    if (errno) cerr << ": " << strerror(errno);
+    cerr << "\n";
+    exit(1);
+}
+
+double microsSince(Clock::time_point start) {
+    return chrono::duration<double, micro>(Clock::now() - start).count();
+}
+
+// ==================== Bookstore Process ====================
+
+class Bookstore {
+private:
+    pid_t pid;
+    int input;  // its stdin
+    int output; // its stdout
+    string reply;
+
+public:
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+
+    Bookstore(const string& binary, const string& dir, const string& allocLib, const string& counterPath) {
+        int in[2], out[2];
+        if (pipe(in) < 0 || pipe(out) < 0) die("pipe");
+        pid = fork();
+        if (pid < 0) die("fork");
+        if (pid == 0) {
+            dup2(in[0], STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            close(in[0]); close(in[1]); close(out[0]); close(out[1]);
+            if (chdir(dir.c_str()) < 0) _exit(127);
+            if (!allocLib.empty()) {
+                setenv("LD_PRELOAD", allocLib.c_str(), 1);
+                setenv("BENCH_ALLOC_COUNTER", counterPath.c_str(), 1);
+            }
+            execl(binary.c_str(), binary.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        close(in[0]);
+        close(out[1]);
+        input = in[1];
+        output = out[0];
+    }
+
+    // Sends `lines` followed by the sync query and waits for its row
+    void roundTrip(const string& lines) {
+        string message = lines + SYNC_COMMAND;
+        for (size_t done = 0; done < message.size();) {
+            ssize_t n = write(input, message.data() + done, message.size() - done);
+            if (n < 0) die("write to bookstore");
+            done += n;
+        }
+        bytesSent += message.size();
+
+        size_t rowLength = strlen(SYNC_ROW);
+        reply.clear();
+        char chunk[1 << 16];
+        while (true) {
+            if (reply.size() >= rowLength && reply.compare(reply.size() - rowLength, rowLength, SYNC_ROW) == 0
+                && (reply.size() == rowLength || reply[reply.size() - rowLength - 1] == '\n')) {
+                break;
+            }
+            pollfd p{output, POLLIN, 0};
+            if (poll(&p, 1, REPLY_TIMEOUT_MS) <= 0) {
+                errno = 0;
+                die("no reply to: " + lines.substr(0, lines.find('\n')));
+            }
+            ssize_t n = read(output, chunk, sizeof(chunk));
+            if (n <= 0) {
+                errno = 0;
+                die("bookstore exited during: " + lines.substr(0, lines.find('\n')));
+            }
+            reply.append(chunk, n);
+            bytesReceived += n;
+        }
+    }
+
+    // Counters from /proc/PID/io; empty when the kernel does not provide them
+    map<string, uint64_t> ioCounters() {
+        map<string, uint64_t> counters;
+        ifstream in("/proc/" + to_string(pid) + "/io");
+        string name;
+        uint64_t value;
+        while (in >> name >> value) {
+            counters[name.substr(0, name.size() - 1)] = value;
+        }
+        return counters;
+    }
+
+    // Closes stdin and waits for a clean exit
+    rusage finish() {
+        close(input);
+        int status;
+        rusage usage;
+        if (wait4(pid, &status, 0, &usage) < 0) die("wait");
+        close(output);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            errno = 0;
+            die("bookstore did not exit cleanly");
+        }
+        return usage;
+    }
+};
+
+// ==================== Statistics ====================
+
+struct Series {
+    vector<double> micros;
+    double allocations = 0; // net of the sync query
+
+    double percentile(double q) const {
+        size_t at = min(micros.size() - 1, (size_t)(q * micros.size()));
+        return micros[at];
+    }
+};
+
+// The command as reported: its first word, or its first two for
+// `show finance`, `report finance` and `report employee`
+string commandType(const string& line) {
+    size_t first = line.find(' ');
+    string type = line.substr(0, first);
+    if (first != string::npos && (type == "show" || type == "report")) {
+        size_t second = line.find(' ', first + 1);
+        string arg = line.substr(first + 1, second == string::npos ? string::npos : second - first - 1);
+        if (arg == "finance" || arg == "employee") type += " " + arg;
+    }
+    return type;
+}
+
+double median(vector<double> values) {
+    sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+double mebibytes(uint64_t bytes) {
+    return bytes / 1048576.0;
+}
+
+// Counts the files left in `dir` and their total size, then removes them
+void sweepDirectory(const string& dir, size_t& files, uint64_t& bytes) {
+    files = 0;
+    bytes = 0;
+    DIR* d = opendir(dir.c_str());
+    if (!d) die("opendir " + dir);
+    while (dirent* entry = readdir(d)) {
+        string path = dir + "/" + entry->d_name;
+        struct stat st;
+        if (lstat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode)) continue;
+        files++;
+        bytes += st.st_size;
+        unlink(path.c_str());
+    }
+    closedir(d);
+    rmdir(dir.c_str());
+}
+
+string absolutePath(const char* path) {
+    char resolved[PATH_MAX];
+    if (!realpath(path, resolved)) die(path);
+    return resolved;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "usage: harness BINARY WORKLOAD [ALLOC_COUNTER_LIB]\n";
+        return 2;
+    }
+    string binary = absolutePath(argv[1]);
+    string allocLib = argc > 3 ? absolutePath(argv[3]) : "";
+
+    vector<string> commands;
+    {
+        ifstream in(argv[2]);
+        if (!in) die(argv[2]);
+        string line;
+        while (getline(in, line)) {
+            if (!line.empty()) commands.push_back(line);
+        }
+    }
+
+    char dirTemplate[] = "/tmp/bookstore-bench.XXXXXX";
+    if (!mkdtemp(dirTemplate)) die("mkdtemp");
+    string dir = dirTemplate;
+    string counterPath = dir + ".allocs";
+    int counterFd = open(counterPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (counterFd < 0 || ftruncate(counterFd, sizeof(uint64_t)) < 0) die(counterPath);
+    volatile uint64_t* allocations = (volatile uint64_t*)mmap(nullptr, sizeof(uint64_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED, counterFd, 0);
+    if (allocations == MAP_FAILED) die("mmap");
+    close(counterFd);
+
+    // ---- Replay ----
+    Bookstore store(binary, dir, allocLib, counterPath);
+    store.roundTrip("su root sjtu\nselect !sync\nsu root sjtu\n");
+
+    vector<double> syncMicros;
+    vector<double> syncAllocations;
+    for (int i = 0; i < CALIBRATION_ROUNDS; i++) {
+        uint64_t before = *allocations;
+        auto start = Clock::now();
+        store.roundTrip("");
+        syncMicros.push_back(microsSince(start));
+        syncAllocations.push_back(*allocations - before);
+    }
+    double syncCost = median(syncMicros);
+    double syncAllocs = median(syncAllocations);
+
+    map<string, Series> series;
+    auto replayStart = Clock::now();
+    for (const string& command : commands) {
+        uint64_t before = *allocations;
+        auto start = Clock::now();
+        store.roundTrip(command + "\n");
+        Series& s = series[commandType(command)];
+        s.micros.push_back(max(0.0, microsSince(start) - syncCost));
+        s.allocations += (double)(*allocations - before) - syncAllocs;
+    }
+    double replaySeconds = microsSince(replayStart) / 1e6;
+    map<string, uint64_t> io = store.ioCounters();
+    uint64_t pipeIn = store.bytesSent;
+    uint64_t pipeOut = store.bytesReceived;
+    rusage usage = store.finish();
+
+    // ---- Restart on the data just written ----
+    Bookstore restarted(binary, dir, "", "");
+    auto restartBegin = Clock::now();
+    restarted.roundTrip("su root sjtu\n");
+    double startupMillis = microsSince(restartBegin) / 1000;
+    restarted.finish();
+
+    size_t files;
+    uint64_t bytes;
+    sweepDirectory(dir, files, bytes);
+    unlink(counterPath.c_str());
+
+    // ---- Report ----
+    printf("workload %s: %zu commands\n", argv[2], commands.size());
+    printf("%-16s %8s %10s %10s %10s %10s %10s %10s\n",
+           "command", "count", "mean(us)", "p50", "p90", "p99", "max", allocLib.empty() ? "" : "allocs/cmd");
+    for (auto& entry : series) {
+        Series& s = entry.second;
+        sort(s.micros.begin(), s.micros.end());
+        double total = 0;
+        for (double m : s.micros) total += m;
+        printf("%-16s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f", entry.first.c_str(), s.micros.size(),
+               total / s.micros.size(), s.percentile(0.5), s.percentile(0.9), s.percentile(0.99), s.micros.back());
+        if (!allocLib.empty()) printf(" %10.1f", s.allocations / s.micros.size());
+        printf("\n");
+    }
+    printf("throughput: %.0f commands/s (%.2f s, sync query %.1f us taken off each sample)\n",
+           commands.size() / replaySeconds, replaySeconds, syncCost);
+    printf("peak RSS: %.1f MiB\n", usage.ru_maxrss / 1024.0);
+    if (io.count("rchar")) {
+        printf("I/O: %.2f MiB read, %.2f MiB written by syscalls outside stdin/stdout; "
+               "%.2f MiB read, %.2f MiB written to storage\n",
+               mebibytes(io["rchar"] - min(io["rchar"], pipeIn)), mebibytes(io["wchar"] - min(io["wchar"], pipeOut)),
+               mebibytes(io["read_bytes"]), mebibytes(io["write_bytes"]));
+    } else {
+        printf("I/O: not available (no /proc/PID/io)\n");
+    }
+    printf("files: %zu, %.2f MiB\n", files, mebibytes(bytes));
+    printf("startup: %.2f ms to the first reply\n\n", startupMillis);
+    return 0;
+}
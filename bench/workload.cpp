@@ -0,0 +1,286 @@
+// Deterministic workload generator for the benchmark suite.
+//
+//     workload SCENARIO [SCALE] [SEED] > commands.txt
+//
+// Every scenario is a plain command stream for ./code. It assumes it runs
+// on top of a root session that it never logs out of, and only logs out of
+// sessions it opened itself, so the stream can be replayed by the harness
+// or piped straight into the binary.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// ==================== Random Source ====================
+
+// splitmix64; the same seed gives the same workload on every platform
+class Random {
+private:
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, n)
+    size_t below(size_t n) {
+        return next() % n;
+    }
+
+    bool chance(unsigned percent) {
+        return below(100) < percent;
+    }
+};
+
+// ==================== Vocabulary ====================
+
+const char* const WORDS[] = {
+    "alpha", "amber", "arrow", "atlas", "basil", "birch", "blaze", "brook",
+    "cedar", "chalk", "cider", "cloud", "coral", "crane", "delta", "drift",
+    "ember", "fable", "fern", "flint", "frost", "gale", "glade", "grove",
+    "harbor", "hazel", "heron", "iris", "ivory", "jade", "juniper", "kelp",
+    "lark", "lotus", "lumen", "maple", "marsh", "mesa", "mist", "moss",
+    "nova", "oak", "onyx", "opal", "orbit", "pearl", "pine", "plume",
+    "quartz", "quill", "raven", "reef", "ridge", "river", "sable", "sage",
+    "shale", "slate", "spruce", "storm", "tide", "topaz", "umber", "vale",
+    "willow", "wren", "yarrow", "zephyr", "zinc", "aster", "bloom", "canyon",
+};
+const size_t WORD_COUNT = sizeof(WORDS) / sizeof(WORDS[0]);
+
+struct Generator {
+    Random random;
+    size_t scale;
+    vector<string> users;    // registered and not deleted, password = "pw" + userID
+    vector<string> books;    // ISBNs created so far
+    size_t nextUser = 0;
+    size_t nextBook = 0;
+
+    Generator(uint64_t seed, size_t s) : random(seed), scale(s) {}
+
+    const char* word() {
+        return WORDS[random.below(WORD_COUNT)];
+    }
+
+    // Names cannot contain spaces
+    string phrase(size_t words) {
+        string result = word();
+        for (size_t i = 1; i < words; i++) {
+            result += '-';
+            result += word();
+        }
+        return result;
+    }
+
+    // Distinct segments, at most 60 characters in all
+    string keywords(size_t segments) {
+        string result;
+        vector<const char*> used;
+        for (size_t i = 0; i < segments; i++) {
+            const char* w = word();
+            bool seen = false;
+            for (const char* u : used) seen |= strcmp(u, w) == 0;
+            if (seen || result.size() + strlen(w) + 1 > 60) continue;
+            if (!result.empty()) result += '|';
+            result += w;
+            used.push_back(w);
+        }
+        return result;
+    }
+
+    string price() {
+        return to_string(1 + random.below(200)) + "." + to_string(10 + random.below(90));
+    }
+
+    const string& anyBook() {
+        return books[random.below(books.size())];
+    }
+
+    // ==================== Building Blocks ====================
+
+    void addUsers(size_t count, int privilege) {
+        for (size_t i = 0; i < count; i++) {
+            string id = "user" + to_string(nextUser++);
+            cout << "useradd " << id << " pw" << id << " " << privilege << " " << word() << "\n";
+            users.push_back(id);
+        }
+    }
+
+    void addBooks(size_t count, size_t keywordSegments) {
+        for (size_t i = 0; i < count; i++) {
+            string isbn = "978" + to_string(1000000 + nextBook++);
+            cout << "select " << isbn << "\n";
+            cout << "modify -name=\"" << phrase(1 + random.below(3)) << "\" -author=\"" << phrase(2)
+                 << "\" -keyword=\"" << keywords(1 + random.below(keywordSegments))
+                 << "\" -price=" << price() << "\n";
+            cout << "import " << 1 + random.below(500) << " " << price() << "\n";
+            books.push_back(isbn);
+        }
+    }
+
+    void query() {
+        switch (random.below(5)) {
+        case 0: cout << "show -ISBN=" << anyBook() << "\n"; break;
+        case 1: cout << "show -name=\"" << phrase(1 + random.below(2)) << "\"\n"; break;
+        case 2: cout << "show -author=\"" << phrase(2) << "\"\n"; break;
+        default: cout << "show -keyword=\"" << word() << "\"\n"; break;
+        }
+    }
+
+    void trade() {
+        if (random.chance(70)) {
+            cout << "buy " << anyBook() << " " << 1 + random.below(3) << "\n";
+        } else {
+            cout << "select " << anyBook() << "\n";
+            cout << "import " << 1 + random.below(100) << " " << price() << "\n";
+        }
+    }
+
+    // ==================== Scenarios ====================
+
+    // Many accounts: creation, logins, password changes and deletions
+    void accounts() {
+        size_t n = 2000 * scale;
+        cout << "su root sjtu\n";
+        addUsers(n, 1);
+        for (size_t i = 0; i < n; i++) {
+            const string& id = users[random.below(users.size())];
+            cout << "su " << id << " pw" << id << "\n";
+            if (random.chance(30)) cout << "passwd " << id << " pw" << id << " pw" << id << "\n";
+            cout << "logout\n";
+            if (random.chance(10)) {
+                cout << "register self" << i << " pwself" << i << " " << word() << "\n";
+            }
+        }
+        for (size_t i = 0; i < n / 4; i++) {
+            size_t at = random.below(users.size());
+            cout << "delete " << users[at] << "\n";
+            users[at] = users.back();
+            users.pop_back();
+        }
+        cout << "logout\n";
+    }
+
+    // A large catalog with many keywords per book, then searches over it
+    void catalog() {
+        size_t m = 3000 * scale;
+        cout << "su root sjtu\n";
+        addBooks(m, 8);
+        for (size_t i = 0; i < m; i++) {
+            query();
+            if (i % 1000 == 999) cout << "show\n";
+        }
+        for (size_t i = 0; i < m / 10; i++) {
+            cout << "select " << anyBook() << "\n";
+            cout << "modify -keyword=\"" << keywords(1 + random.below(8)) << "\"\n";
+        }
+        cout << "logout\n";
+    }
+
+    // Deep su chains that select, sell and delete at depth
+    void logins() {
+        size_t depth = 200 * scale;
+        cout << "su root sjtu\n";
+        addUsers(depth, 3);
+        addBooks(100, 3);
+        for (size_t round = 0; round < 10; round++) {
+            vector<size_t> stack;
+            for (size_t d = 0; d < depth; d++) {
+                stack.push_back(random.below(users.size()));
+                const string& id = users[stack.back()];
+                cout << "su " << id << " pw" << id << "\n";
+                cout << "select " << anyBook() << "\n";
+                if (random.chance(20)) trade();
+            }
+            // Only users on the stack, so every delete is refused
+            cout << "su root sjtu\n";
+            for (size_t i = 0; i < 50; i++) {
+                cout << "delete " << users[stack[random.below(stack.size())]] << "\n";
+            }
+            cout << "logout\n";
+            for (size_t d = 0; d < depth; d++) {
+                cout << "logout\n";
+                if (random.chance(20)) cout << "import 1 1.00\n";
+            }
+        }
+        cout << "logout\n";
+    }
+
+    // A long ledger, then finance queries of every length
+    void finance() {
+        size_t trades = 20000 * scale;
+        cout << "su root sjtu\n";
+        addBooks(200, 3);
+        for (size_t i = 0; i < trades; i++) {
+            trade();
+            if (i % 100 == 99) {
+                cout << "show finance " << random.below(i) << "\n";
+                cout << "show finance\n";
+            }
+        }
+        cout << "report finance\n";
+        cout << "report employee\n";
+        cout << "logout\n";
+    }
+
+    // Everything at once, weighted like a day at the shop
+    void mixed() {
+        size_t n = 10000 * scale;
+        cout << "su root sjtu\n";
+        addUsers(200, 3);
+        addBooks(1000, 5);
+        for (size_t i = 0; i < n; i++) {
+            size_t pick = random.below(100);
+            if (pick < 40) {
+                query();
+            } else if (pick < 75) {
+                trade();
+            } else if (pick < 90) {
+                const string& id = users[random.below(users.size())];
+                cout << "su " << id << " pw" << id << "\n";
+                cout << "select " << anyBook() << "\n";
+                cout << "modify -price=" << price() << "\n";
+                cout << "logout\n";
+            } else if (pick < 98) {
+                cout << "show finance " << random.below(50) << "\n";
+            } else {
+                cout << "report finance\n";
+            }
+            if (i % 2500 == 2499) cout << "log\n";
+        }
+        cout << "logout\n";
+    }
+};
+
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+    if (argc < 2) {
+        cerr << "usage: workload accounts|catalog|logins|finance|mixed [SCALE] [SEED]\n";
+        return 2;
+    }
+    string scenario = argv[1];
+    size_t scale = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1;
+    uint64_t seed = argc > 3 ? strtoull(argv[3], nullptr, 10) : 20240501;
+    if (scale == 0) scale = 1;
+
+    Generator gen(seed, scale);
+    if (scenario == "accounts") gen.accounts();
+    else if (scenario == "catalog") gen.catalog();
+    else if (scenario == "logins") gen.logins();
+    else if (scenario == "finance") gen.finance();
+    else if (scenario == "mixed") gen.mixed();
+    else {
+        cerr << "unknown scenario: " << scenario << "\n";
+        return 2;
+    }
+    return 0;
+}
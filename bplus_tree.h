@@ -0,0 +1,660 @@
+#ifndef BOOKSTORE_BPLUS_TREE_H
+#define BOOKSTORE_BPLUS_TREE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "buffer_pool.h"
+#include "free_space_map.h"
+
+// ==================== B+ Tree ====================
+
+// Disk-resident B+ tree mapping fixed-size keys to fixed-size values. Every
+// node occupies exactly one page of the underlying file; page 0 holds the
+// tree header. Nodes are accessed in place through the shared buffer pool,
+// and records live in the leaves, so updating a value dirties a single page.
+//
+// Erase does not rebalance: leaves may underflow (or become empty) and the
+// internal separators stay valid routing keys, which keeps lookups correct.
+// compactStep() tidies up afterwards, a little at a time: it merges sparse
+// neighbouring leaves, drops empty ones, and moves pages from the end of
+// the file into free pages further forward so the file can shrink.
+//
+// Structural changes (insert, erase) need the tree to themselves. Lookups,
+// scans and in-place updates may run concurrently: they latch the leaf
+// page they touch, shared to read a record and exclusive to rewrite one.
+template <class Key, class Value>
+class BPlusTree {
+private:
+    static const uint32_t MAGIC = 0x31545042; // "BPT1"
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t root; // 0 while the tree is empty
+        uint32_t reserved;
+        uint64_t size;
+        FreeSpaceMap::State freeSpace;
+    };
+
+    struct NodeHeader {
+        uint32_t isLeaf;
+        uint32_t count;
+        uint32_t next; // right sibling, leaves only
+    };
+
+    static constexpr int LEAF_MAX =
+        (PAGE_SIZE - sizeof(NodeHeader) - alignof(Value)) / (sizeof(Key) + sizeof(Value));
+    static constexpr int INTERNAL_MAX =
+        (PAGE_SIZE - sizeof(NodeHeader) - 2 * sizeof(uint32_t)) / (sizeof(Key) + sizeof(uint32_t));
+
+    struct LeafNode {
+        NodeHeader h;
+        Key keys[LEAF_MAX];
+        Value values[LEAF_MAX];
+    };
+
+    struct InternalNode {
+        NodeHeader h;
+        Key keys[INTERNAL_MAX];
+        uint32_t children[INTERNAL_MAX + 1];
+    };
+
+    static_assert(LEAF_MAX >= 3, "B+ tree leaf holds too few records");
+    static_assert(INTERNAL_MAX >= 3, "B+ tree node holds too few keys");
+    static_assert(sizeof(LeafNode) <= PAGE_SIZE, "leaf does not fit in a page");
+    static_assert(sizeof(InternalNode) <= PAGE_SIZE, "node does not fit in a page");
+
+    struct Split {
+        bool happened;
+        Key key;       // smallest key reachable through the new page
+        uint32_t page;
+    };
+
+    struct Link {
+        uint32_t parent;
+        int slot;
+    };
+
+    // Where every node hangs, gathered from the internal nodes alone. It is
+    // built once and the compaction steps keep it up to date as they go;
+    // only an insert that splits a node makes it stale again.
+    struct Layout {
+        bool stale;
+        std::unordered_map<uint32_t, Link> parents; // the root has no entry
+        size_t leafCount;
+
+        const Link* parentOf(uint32_t id) const {
+            auto it = parents.find(id);
+            return it != parents.end() ? &it->second : nullptr;
+        }
+    };
+
+    // Neighbouring leaves are merged when the result is at most this full,
+    // which leaves room for inserts before the merged leaf splits again
+    static constexpr int MERGE_LIMIT = LEAF_MAX * 3 / 4;
+    // Leaves examined per compaction step
+    static const size_t COMPACT_BATCH = 64;
+
+    BufferPool& pool;
+    PagedFile file;
+    Header header;
+    FreeSpaceMap freeSpace;
+    uint32_t compactCursor; // leaf the next compaction step starts at; 0 for the first
+    size_t uncheckedLeaves; // leaves still to examine since the last erase
+    Layout layout;
+
+    void writeHeader() {
+        PageGuard page = pool.fetch(file, 0);
+        memcpy(page.data(), &header, sizeof(header));
+        page.markDirty();
+    }
+
+    static bool isLeaf(const PageGuard& page) {
+        return page.as<NodeHeader>()->isLeaf;
+    }
+
+    // First index whose key is not less than `key`
+    static int lowerBound(const Key* keys, int count, const Key& key) {
+        int lo = 0, hi = count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (keys[mid] < key) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    // First index whose key is greater than `key`
+    static int upperBound(const Key* keys, int count, const Key& key) {
+        int lo = 0, hi = count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (key < keys[mid]) hi = mid;
+            else lo = mid + 1;
+        }
+        return lo;
+    }
+
+    // Descends to the leaf that would hold `key`
+    PageGuard findLeaf(const Key& key) {
+        PageGuard page = pool.fetch(file, header.root);
+        while (!isLeaf(page)) {
+            InternalNode* node = page.as<InternalNode>();
+            uint32_t child = node->children[upperBound(node->keys, node->h.count, key)];
+            page = pool.fetch(file, child);
+        }
+        return page;
+    }
+
+    static void readValue(const PageGuard& page, const Value& stored, Value& value) {
+        std::shared_lock<std::shared_mutex> latch(page.latch());
+        value = stored;
+    }
+
+    PageGuard leftmostLeaf() {
+        PageGuard page = pool.fetch(file, header.root);
+        while (!isLeaf(page)) {
+            uint32_t child = page.as<InternalNode>()->children[0];
+            page = pool.fetch(file, child);
+        }
+        return page;
+    }
+
+    bool insertInto(uint32_t id, const Key& key, const Value& value, Split& split) {
+        PageGuard page = pool.fetch(file, id);
+        split.happened = false;
+
+        if (isLeaf(page)) {
+            LeafNode* leaf = page.as<LeafNode>();
+            int n = leaf->h.count;
+            int pos = lowerBound(leaf->keys, n, key);
+            if (pos < n && leaf->keys[pos] == key) return false;
+
+            if (n < LEAF_MAX) {
+                memmove(&leaf->keys[pos + 1], &leaf->keys[pos], (n - pos) * sizeof(Key));
+                memmove(&leaf->values[pos + 1], &leaf->values[pos], (n - pos) * sizeof(Value));
+                leaf->keys[pos] = key;
+                leaf->values[pos] = value;
+                leaf->h.count++;
+                page.markDirty();
+                return true;
+            }
+
+            // Full leaf: spread n + 1 records over this leaf and a new right
+            // sibling. The sibling is filled first, so the leaf can then be
+            // rearranged in place.
+            int total = n + 1;
+            int leftCount = total / 2;
+            layout.stale = true;
+            PageGuard right = freeSpace.allocate();
+            uint32_t rightId = right.pageId();
+            LeafNode* rightLeaf = right.as<LeafNode>();
+            rightLeaf->h.isLeaf = 1;
+            rightLeaf->h.count = total - leftCount;
+            rightLeaf->h.next = leaf->h.next;
+            for (int i = leftCount; i < total; i++) {
+                int from = i > pos ? i - 1 : i;
+                rightLeaf->keys[i - leftCount] = i == pos ? key : leaf->keys[from];
+                rightLeaf->values[i - leftCount] = i == pos ? value : leaf->values[from];
+            }
+
+            if (pos < leftCount) {
+                memmove(&leaf->keys[pos + 1], &leaf->keys[pos], (leftCount - 1 - pos) * sizeof(Key));
+                memmove(&leaf->values[pos + 1], &leaf->values[pos], (leftCount - 1 - pos) * sizeof(Value));
+                leaf->keys[pos] = key;
+                leaf->values[pos] = value;
+            }
+            leaf->h.count = leftCount;
+            leaf->h.next = rightId;
+
+            page.markDirty();
+            split.happened = true;
+            split.key = rightLeaf->keys[0];
+            split.page = rightId;
+            return true;
+        }
+
+        InternalNode* node = page.as<InternalNode>();
+        int n = node->h.count;
+        int idx = upperBound(node->keys, n, key);
+        Split childSplit;
+        if (!insertInto(node->children[idx], key, value, childSplit)) return false;
+        if (!childSplit.happened) return true;
+
+        if (n < INTERNAL_MAX) {
+            memmove(&node->keys[idx + 1], &node->keys[idx], (n - idx) * sizeof(Key));
+            memmove(&node->children[idx + 2], &node->children[idx + 1], (n - idx) * sizeof(uint32_t));
+            node->keys[idx] = childSplit.key;
+            node->children[idx + 1] = childSplit.page;
+            node->h.count++;
+            page.markDirty();
+            return true;
+        }
+
+        // Full node: push the middle key up to the parent. As with leaves,
+        // the right sibling is filled first and this node fixed in place.
+        auto keyAt = [&](int i) -> const Key& {
+            return i < idx ? node->keys[i] : i == idx ? childSplit.key : node->keys[i - 1];
+        };
+        auto childAt = [&](int i) {
+            return i <= idx ? node->children[i] : i == idx + 1 ? childSplit.page : node->children[i - 1];
+        };
+
+        int total = n + 1;
+        int mid = total / 2;
+        Key middle = keyAt(mid);
+        PageGuard right = freeSpace.allocate();
+        uint32_t rightId = right.pageId();
+        InternalNode* rightNode = right.as<InternalNode>();
+        rightNode->h.isLeaf = 0;
+        rightNode->h.count = total - mid - 1;
+        for (int i = mid + 1; i < total; i++) {
+            rightNode->keys[i - mid - 1] = keyAt(i);
+        }
+        for (int i = mid + 1; i <= total; i++) {
+            rightNode->children[i - mid - 1] = childAt(i);
+        }
+
+        if (idx < mid) {
+            memmove(&node->keys[idx + 1], &node->keys[idx], (mid - 1 - idx) * sizeof(Key));
+            memmove(&node->children[idx + 2], &node->children[idx + 1], (mid - 1 - idx) * sizeof(uint32_t));
+            node->keys[idx] = childSplit.key;
+            node->children[idx + 1] = childSplit.page;
+        }
+        node->h.count = mid;
+
+        page.markDirty();
+        split.happened = true;
+        split.key = middle;
+        split.page = rightId;
+        return true;
+    }
+
+    // ---- Compaction ----
+
+    // Every leaf is this many levels below the root
+    int leafDepth() {
+        int depth = 0;
+        PageGuard page = pool.fetch(file, header.root);
+        while (!isLeaf(page)) {
+            page = pool.fetch(file, page.as<InternalNode>()->children[0]);
+            depth++;
+        }
+        return depth;
+    }
+
+    void mapNode(uint32_t id, int depth) {
+        if (depth == 0) {
+            layout.leafCount++;
+            return;
+        }
+        PageGuard page = pool.fetch(file, id);
+        InternalNode* node = page.as<InternalNode>();
+        for (int i = 0; i <= (int)node->h.count; i++) {
+            layout.parents[node->children[i]] = Link{id, i};
+            mapNode(node->children[i], depth - 1);
+        }
+    }
+
+    // Walks the whole tree, so only when the layout is stale
+    void mapLayout() {
+        if (!layout.stale) return;
+        layout.parents.clear();
+        layout.leafCount = 0;
+        if (header.root != 0) mapNode(header.root, leafDepth());
+        layout.stale = false;
+    }
+
+    // The leaf before `id` in key order, or 0 for the first one: up to the
+    // nearest ancestor with a child to the left, then down that child's
+    // rightmost path
+    uint32_t leafBefore(uint32_t id) {
+        const Link* link = layout.parentOf(id);
+        while (link && link->slot == 0) link = layout.parentOf(link->parent);
+        if (!link) return 0;
+        PageGuard page = pool.fetch(file, link->parent);
+        uint32_t child = page.as<InternalNode>()->children[link->slot - 1];
+        page = pool.fetch(file, child);
+        while (!isLeaf(page)) {
+            InternalNode* node = page.as<InternalNode>();
+            child = node->children[node->h.count];
+            page = pool.fetch(file, child);
+        }
+        return child;
+    }
+
+    // Unhooks node `id` from its parent and frees it. A parent left with no
+    // children goes the same way. Removing the first child drops the first
+    // separator, so the next child takes over the smaller keys.
+    void removeNode(uint32_t id) {
+        const Link* link = layout.parentOf(id);
+        if (!link) {
+            header.root = 0;
+        } else {
+            uint32_t parentId = link->parent;
+            int slot = link->slot;
+            layout.parents.erase(id);
+            PageGuard page = pool.fetch(file, parentId);
+            InternalNode* node = page.as<InternalNode>();
+            int n = node->h.count;
+            if (n == 0) {
+                page.release();
+                removeNode(parentId);
+            } else {
+                int key = slot == 0 ? 0 : slot - 1;
+                memmove(&node->keys[key], &node->keys[key + 1], (n - key - 1) * sizeof(Key));
+                memmove(&node->children[slot], &node->children[slot + 1], (n - slot) * sizeof(uint32_t));
+                node->h.count--;
+                for (int i = slot; i < n; i++) {
+                    layout.parents[node->children[i]].slot = i;
+                }
+                page.markDirty();
+            }
+        }
+        freeSpace.release(id);
+    }
+
+    // A root with a single child hands the root over to it
+    void collapseRoot() {
+        while (header.root != 0) {
+            PageGuard page = pool.fetch(file, header.root);
+            if (isLeaf(page) || page.as<InternalNode>()->h.count > 0) return;
+            uint32_t old = header.root;
+            header.root = page.as<InternalNode>()->children[0];
+            layout.parents.erase(header.root);
+            page.release();
+            freeSpace.release(old);
+        }
+    }
+
+    // Drops the leaf at the cursor if it is empty, or merges its right
+    // neighbour into it if both share a parent and fit in MERGE_LIMIT
+    // records. Returns true if the tree changed; otherwise the cursor moves
+    // on to the next leaf.
+    bool tidyLeaf() {
+        uint32_t id = compactCursor;
+        PageGuard page = pool.fetch(file, id);
+        LeafNode* leaf = page.as<LeafNode>();
+        uint32_t next = leaf->h.next;
+        if (layout.leafCount >= 2 && leaf->h.count == 0) {
+            uint32_t prevId = leafBefore(id);
+            if (prevId != 0) {
+                PageGuard prev = pool.fetch(file, prevId);
+                prev.as<LeafNode>()->h.next = next;
+                prev.markDirty();
+            }
+            page.release();
+            removeNode(id);
+            layout.leafCount--;
+            compactCursor = next;
+            return true;
+        }
+        if (layout.leafCount >= 2 && next != 0
+            && layout.parentOf(id)->parent == layout.parentOf(next)->parent) {
+            PageGuard rightPage = pool.fetch(file, next);
+            LeafNode* right = rightPage.as<LeafNode>();
+            int n = leaf->h.count;
+            int m = right->h.count;
+            if (n + m <= MERGE_LIMIT) {
+                memcpy(&leaf->keys[n], right->keys, m * sizeof(Key));
+                memcpy(&leaf->values[n], right->values, m * sizeof(Value));
+                leaf->h.count = n + m;
+                leaf->h.next = right->h.next;
+                page.markDirty();
+                rightPage.release();
+                removeNode(next);
+                layout.leafCount--;
+                return true;
+            }
+        }
+        compactCursor = next;
+        return false;
+    }
+
+    // Moves the last page in use into the lowest free page before it
+    bool relocateTail() {
+        uint32_t from = freeSpace.lastUsedPage();
+        if (from == 0) return false;
+        uint32_t to = freeSpace.takeLowest(from);
+        if (to == 0) return false;
+        if (freeSpace.moveMapPage(from, to)) {
+            freeSpace.release(from);
+            return true;
+        }
+
+        mapLayout();
+        const Link* link = layout.parentOf(from);
+        if (from != header.root && !link) {
+            // Nothing points at it, so it was never really in use
+            freeSpace.release(to);
+            freeSpace.release(from);
+            return true;
+        }
+
+        uint32_t prevId = 0;
+        {
+            PageGuard source = pool.fetch(file, from);
+            PageGuard target = pool.fetch(file, to);
+            memcpy(target.data(), source.data(), PAGE_SIZE);
+            target.markDirty();
+            if (isLeaf(target)) {
+                prevId = leafBefore(from);
+            } else {
+                InternalNode* node = target.as<InternalNode>();
+                for (int i = 0; i <= (int)node->h.count; i++) {
+                    layout.parents[node->children[i]].parent = to;
+                }
+            }
+        }
+        if (from == header.root) {
+            header.root = to;
+        } else {
+            Link where = *link;
+            PageGuard parent = pool.fetch(file, where.parent);
+            parent.as<InternalNode>()->children[where.slot] = to;
+            parent.markDirty();
+            layout.parents.erase(from);
+            layout.parents[to] = where;
+        }
+        if (prevId != 0) {
+            PageGuard prev = pool.fetch(file, prevId);
+            prev.as<LeafNode>()->h.next = to;
+            prev.markDirty();
+        }
+        if (compactCursor == from) compactCursor = to;
+        freeSpace.release(from);
+        return true;
+    }
+
+public:
+    BPlusTree(BufferPool& bufferPool, const std::string& path)
+        : pool(bufferPool), file(path), freeSpace(pool, file, header.freeSpace),
+          compactCursor(0), uncheckedLeaves(SIZE_MAX) {
+        layout.stale = true;
+        layout.leafCount = 0;
+        if (file.pageCount() == 0) {
+            pool.allocate(file);
+        }
+        memcpy(&header, pool.fetch(file, 0).data(), sizeof(header));
+        if (!checkFormat(&header, MAGIC, path)) {
+            header.magic = MAGIC;
+            header.version = FORMAT_VERSION;
+            header.root = 0;
+            header.reserved = 0;
+            header.size = 0;
+            memset(&header.freeSpace, 0, sizeof(header.freeSpace));
+            writeHeader();
+        }
+    }
+
+    uint64_t size() const {
+        return header.size;
+    }
+
+    bool empty() const {
+        return header.size == 0;
+    }
+
+    bool contains(const Key& key) {
+        Value value;
+        return find(key, value);
+    }
+
+    bool find(const Key& key, Value& value) {
+        if (header.root == 0) return false;
+        PageGuard page = findLeaf(key);
+        LeafNode* leaf = page.as<LeafNode>();
+        int pos = lowerBound(leaf->keys, leaf->h.count, key);
+        if (pos == (int)leaf->h.count || !(leaf->keys[pos] == key)) return false;
+        readValue(page, leaf->values[pos], value);
+        return true;
+    }
+
+    // Overwrites the value of an existing key in place
+    bool update(const Key& key, const Value& value) {
+        if (header.root == 0) return false;
+        PageGuard page = findLeaf(key);
+        LeafNode* leaf = page.as<LeafNode>();
+        int pos = lowerBound(leaf->keys, leaf->h.count, key);
+        if (pos == (int)leaf->h.count || !(leaf->keys[pos] == key)) return false;
+        {
+            std::unique_lock<std::shared_mutex> latch(page.latch());
+            leaf->values[pos] = value;
+        }
+        page.markDirty();
+        return true;
+    }
+
+    // Returns false if the key is already present
+    bool insert(const Key& key, const Value& value) {
+        if (header.root == 0) {
+            PageGuard page = freeSpace.allocate();
+            LeafNode* leaf = page.as<LeafNode>();
+            layout.stale = true;
+            leaf->h.isLeaf = 1;
+            leaf->h.count = 1;
+            leaf->keys[0] = key;
+            leaf->values[0] = value;
+            header.root = page.pageId();
+        } else {
+            Split split;
+            if (!insertInto(header.root, key, value, split)) return false;
+            if (split.happened) {
+                PageGuard page = freeSpace.allocate();
+                InternalNode* node = page.as<InternalNode>();
+                node->h.isLeaf = 0;
+                node->h.count = 1;
+                node->keys[0] = split.key;
+                node->children[0] = header.root;
+                node->children[1] = split.page;
+                header.root = page.pageId();
+            }
+        }
+        header.size++;
+        writeHeader();
+        return true;
+    }
+
+    bool erase(const Key& key) {
+        if (header.root == 0) return false;
+        PageGuard page = findLeaf(key);
+        LeafNode* leaf = page.as<LeafNode>();
+        int n = leaf->h.count;
+        int pos = lowerBound(leaf->keys, n, key);
+        if (pos == n || !(leaf->keys[pos] == key)) return false;
+        memmove(&leaf->keys[pos], &leaf->keys[pos + 1], (n - pos - 1) * sizeof(Key));
+        memmove(&leaf->values[pos], &leaf->values[pos + 1], (n - pos - 1) * sizeof(Value));
+        leaf->h.count--;
+        page.markDirty();
+        header.size--;
+        writeHeader();
+        uncheckedLeaves = SIZE_MAX;
+        return true;
+    }
+
+    // Does one bounded piece of compaction; false once there is nothing
+    // left to do. Like insert and erase, it needs the tree to itself.
+    bool compactStep() {
+        if (uncheckedLeaves > 0) {
+            mapLayout();
+            uncheckedLeaves = std::min(uncheckedLeaves, layout.leafCount);
+            for (size_t k = 0; k < COMPACT_BATCH && uncheckedLeaves > 0; k++) {
+                if (compactCursor == 0) compactCursor = leftmostLeaf().pageId();
+                if (tidyLeaf()) {
+                    // The merged leaf may take its next neighbour too
+                    collapseRoot();
+                    writeHeader();
+                    return true;
+                }
+                uncheckedLeaves--;
+            }
+            return true;
+        }
+        if (!relocateTail()) return false;
+        writeHeader();
+        return true;
+    }
+
+    // Gives the free pages at the end of the file back to the file system;
+    // only right after a checkpoint
+    bool trimFreeTail() {
+        if (!freeSpace.trimTail()) return false;
+        writeHeader();
+        return true;
+    }
+
+    // Visits records in key order, starting at the first key not less than
+    // `from`. The visitor returns false to stop early and must not modify
+    // the tree. It runs under each leaf's latch, so it should only copy out
+    // what it needs.
+    template <class Visitor>
+    void scan(const Key& from, Visitor visit) {
+        if (header.root == 0) return;
+        PageGuard page = findLeaf(from);
+        LeafNode* leaf = page.as<LeafNode>();
+        int pos = lowerBound(leaf->keys, leaf->h.count, from);
+        while (true) {
+            uint32_t next;
+            {
+                std::shared_lock<std::shared_mutex> latch(page.latch());
+                for (int i = pos; i < (int)leaf->h.count; i++) {
+                    if (!visit(leaf->keys[i], leaf->values[i])) return;
+                }
+                next = leaf->h.next;
+            }
+            if (next == 0) return;
+            page = pool.fetch(file, next);
+            leaf = page.as<LeafNode>();
+            pos = 0;
+        }
+    }
+
+    template <class Visitor>
+    void scanAll(Visitor visit) {
+        if (header.root == 0) return;
+        PageGuard page = leftmostLeaf();
+        LeafNode* leaf = page.as<LeafNode>();
+        while (true) {
+            uint32_t next;
+            {
+                std::shared_lock<std::shared_mutex> latch(page.latch());
+                for (int i = 0; i < (int)leaf->h.count; i++) {
+                    if (!visit(leaf->keys[i], leaf->values[i])) return;
+                }
+                next = leaf->h.next;
+            }
+            if (next == 0) return;
+            page = pool.fetch(file, next);
+            leaf = page.as<LeafNode>();
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,369 @@
+#ifndef BOOKSTORE_BUFFER_POOL_H
+#define BOOKSTORE_BUFFER_POOL_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <shared_mutex>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "arena.h"
+
+// ==================== Buffer Pool ====================
+
+class BufferPool;
+
+// Pins one cached page for as long as the guard is alive. The page latch
+// is separate from the pin: code that reads a page other threads may be
+// writing takes it shared, and the writers take it exclusive.
+class PageGuard {
+private:
+    BufferPool* pool;
+    uint32_t frame;
+    uint32_t id;
+    char* ptr;
+    std::shared_mutex* pageLatch;
+
+public:
+    PageGuard() : pool(nullptr), frame(0), id(0), ptr(nullptr), pageLatch(nullptr) {}
+    PageGuard(BufferPool* p, uint32_t f, uint32_t pageId, char* data, std::shared_mutex* l)
+        : pool(p), frame(f), id(pageId), ptr(data), pageLatch(l) {}
+
+    PageGuard(PageGuard&& other)
+        : pool(other.pool), frame(other.frame), id(other.id), ptr(other.ptr),
+          pageLatch(other.pageLatch) {
+        other.pool = nullptr;
+    }
+
+    PageGuard& operator=(PageGuard&& other) {
+        if (this != &other) {
+            release();
+            pool = other.pool;
+            frame = other.frame;
+            id = other.id;
+            ptr = other.ptr;
+            pageLatch = other.pageLatch;
+            other.pool = nullptr;
+        }
+        return *this;
+    }
+
+    PageGuard(const PageGuard&) = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+
+    ~PageGuard() {
+        release();
+    }
+
+    uint32_t pageId() const { return id; }
+    char* data() const { return ptr; }
+    std::shared_mutex& latch() const { return *pageLatch; }
+
+    template <class T>
+    T* as() const { return reinterpret_cast<T*>(ptr); }
+
+    inline void markDirty();
+    inline void release();
+};
+
+// Fixed-capacity page cache shared by every data file. Clean frames are
+// recycled in least-recently-used order. Dirty frames are never evicted
+// (no-steal): they stay out of the LRU list until flush() writes them
+// back, so data files only change when the owner flushes, at a checkpoint
+// or when a long batch spills. Owners keep the number of dirty pages
+// bounded that way; if every frame is dirty or pinned the pool grows
+// rather than fail.
+//
+// Every method and the guards may be used from several threads at once.
+// forEachDirty() callers must keep the dirty pages from being modified
+// while it runs.
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t writes;
+    };
+
+private:
+    static const uint32_t NONE = UINT32_MAX;
+
+    struct Frame {
+        PagedFile* file;
+        uint32_t pageId;
+        uint32_t pins;
+        bool dirty;
+        uint32_t prev; // LRU neighbours, most recent at head; clean frames only
+        uint32_t next;
+    };
+
+    std::vector<char*> blocks; // frame memory, never moved once handed out
+    std::vector<std::unique_ptr<std::shared_mutex[]>> latchBlocks; // one page latch per frame
+    size_t blockFrames;
+    std::vector<Frame> frames;
+    std::vector<uint32_t> freeFrames;
+    typedef std::pair<const uint64_t, uint32_t> TableEntry;
+    NodePool tableNodes; // a miss reuses the node its eviction freed
+    std::unordered_map<uint64_t, uint32_t, std::hash<uint64_t>, std::equal_to<uint64_t>,
+                       PoolAllocator<TableEntry>> table;
+    uint32_t head;
+    uint32_t tail;
+    size_t dirtyCount;
+    Stats stats;
+    std::mutex poolLatch; // protects the frame table, the LRU list and the pins
+
+    static uint64_t keyOf(const PagedFile* file, uint32_t pageId) {
+        return ((uint64_t)file->fileId() << 32) | pageId;
+    }
+
+    char* frameData(uint32_t f) {
+        return blocks[f / blockFrames] + (size_t)(f % blockFrames) * PAGE_SIZE;
+    }
+
+    std::shared_mutex* frameLatch(uint32_t f) {
+        return &latchBlocks[f / blockFrames][f % blockFrames];
+    }
+
+    void unlink(uint32_t f) {
+        Frame& fr = frames[f];
+        if (fr.prev != NONE) frames[fr.prev].next = fr.next;
+        else head = fr.next;
+        if (fr.next != NONE) frames[fr.next].prev = fr.prev;
+        else tail = fr.prev;
+        fr.prev = fr.next = NONE;
+    }
+
+    void pushFront(uint32_t f) {
+        Frame& fr = frames[f];
+        fr.prev = NONE;
+        fr.next = head;
+        if (head != NONE) frames[head].prev = f;
+        head = f;
+        if (tail == NONE) tail = f;
+    }
+
+    void unpin(uint32_t f) {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        frames[f].pins--;
+    }
+
+    void setDirty(uint32_t f) {
+        Frame& fr = frames[f];
+        if (fr.dirty) return;
+        fr.dirty = true;
+        dirtyCount++;
+        unlink(f);
+    }
+
+    void markDirty(uint32_t f) {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        setDirty(f);
+    }
+
+    void writeBack(uint32_t f) {
+        Frame& fr = frames[f];
+        if (!fr.dirty) return;
+        fr.file->write(fr.pageId, frameData(f));
+        fr.dirty = false;
+        dirtyCount--;
+        pushFront(f);
+        stats.writes++;
+    }
+
+    // Finds a frame to hold a new page, evicting the least recently used
+    // clean, unpinned page if the pool is full
+    uint32_t takeFrame() {
+        if (!freeFrames.empty()) {
+            uint32_t f = freeFrames.back();
+            freeFrames.pop_back();
+            return f;
+        }
+        uint32_t f = tail;
+        while (f != NONE && frames[f].pins > 0) f = frames[f].prev;
+        if (f == NONE) {
+            return grow();
+        }
+        table.erase(keyOf(frames[f].file, frames[f].pageId));
+        unlink(f);
+        stats.evictions++;
+        return f;
+    }
+
+    uint32_t grow() {
+        size_t oldCount = frames.size();
+        blocks.push_back((char*)aligned_alloc(PAGE_SIZE, blockFrames * PAGE_SIZE));
+        latchBlocks.emplace_back(new std::shared_mutex[blockFrames]);
+        frames.resize(oldCount + blockFrames);
+        for (size_t f = oldCount + blockFrames - 1; f > oldCount; f--) {
+            freeFrames.push_back(f);
+        }
+        return oldCount;
+    }
+
+    PageGuard install(PagedFile& file, uint32_t pageId, uint32_t f) {
+        Frame& fr = frames[f];
+        fr.file = &file;
+        fr.pageId = pageId;
+        fr.pins = 1;
+        fr.dirty = false;
+        fr.prev = fr.next = NONE;
+        pushFront(f);
+        table[keyOf(&file, pageId)] = f;
+        return PageGuard(this, f, pageId, frameData(f), frameLatch(f));
+    }
+
+    friend class PageGuard;
+
+public:
+    explicit BufferPool(size_t capacityBytes)
+        : table(0, std::hash<uint64_t>(), std::equal_to<uint64_t>(), PoolAllocator<TableEntry>(tableNodes)),
+          head(NONE), tail(NONE), dirtyCount(0) {
+        size_t count = capacityBytes / PAGE_SIZE;
+        if (count < 16) count = 16;
+        table.reserve(count);
+        blockFrames = count;
+        blocks.push_back((char*)aligned_alloc(PAGE_SIZE, count * PAGE_SIZE));
+        latchBlocks.emplace_back(new std::shared_mutex[count]);
+        frames.resize(count);
+        for (size_t f = count; f > 0; f--) {
+            freeFrames.push_back(f - 1);
+        }
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    // Owners flush before their files close; the pool itself cannot tell
+    // which files are still open
+    ~BufferPool() {
+        for (char* block : blocks) free(block);
+    }
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    PageGuard fetch(PagedFile& file, uint32_t pageId) {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        auto it = table.find(keyOf(&file, pageId));
+        if (it != table.end()) {
+            uint32_t f = it->second;
+            stats.hits++;
+            frames[f].pins++;
+            if (!frames[f].dirty && head != f) {
+                unlink(f);
+                pushFront(f);
+            }
+            return PageGuard(this, f, pageId, frameData(f), frameLatch(f));
+        }
+        stats.misses++;
+        uint32_t f = takeFrame();
+        file.read(pageId, frameData(f));
+        return install(file, pageId, f);
+    }
+
+    // Appends a zeroed page to `file` without reading it from disk
+    PageGuard allocate(PagedFile& file) {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        uint32_t pageId = file.allocate();
+        uint32_t f = takeFrame();
+        memset(frameData(f), 0, PAGE_SIZE);
+        PageGuard guard = install(file, pageId, f);
+        setDirty(f);
+        return guard;
+    }
+
+    // Forgets the cached pages of `file` from `firstPage` on, dirty or
+    // not, before the file is truncated; they must not be pinned
+    void discard(PagedFile& file, uint32_t firstPage) {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        for (uint32_t pageId = firstPage; pageId < file.pageCount(); pageId++) {
+            auto it = table.find(keyOf(&file, pageId));
+            if (it == table.end()) continue;
+            uint32_t f = it->second;
+            table.erase(it);
+            if (frames[f].dirty) {
+                frames[f].dirty = false;
+                dirtyCount--;
+            } else {
+                unlink(f);
+            }
+            frames[f].file = nullptr;
+            freeFrames.push_back(f);
+        }
+    }
+
+    size_t dirtyPages() {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        return dirtyCount;
+    }
+
+    // Calls visit(file, pageId, data) for every dirty page. The pages are
+    // collected under the latch, as in flush(), so other threads may fetch
+    // (and grow the pool) meanwhile; dirty frames are never evicted and
+    // their memory never moves, so only their contents must hold still.
+    template <class Visitor>
+    void forEachDirty(Visitor visit) {
+        struct DirtyPage {
+            PagedFile* file;
+            uint32_t pageId;
+            const char* data;
+        };
+        std::vector<DirtyPage> dirty;
+        {
+            std::lock_guard<std::mutex> lock(poolLatch);
+            dirty.reserve(dirtyCount);
+            for (uint32_t f = 0; f < frames.size(); f++) {
+                if (frames[f].file && frames[f].dirty) {
+                    dirty.push_back({frames[f].file, frames[f].pageId, frameData(f)});
+                }
+            }
+        }
+        for (const DirtyPage& page : dirty) {
+            visit(*page.file, page.pageId, page.data);
+        }
+    }
+
+    // Writes every dirty page back to its file and makes the writes durable.
+    // Pages are written in file and page order, so each file is written
+    // front to back.
+    void flush() {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        std::vector<uint32_t> dirty;
+        for (uint32_t f = 0; f < frames.size(); f++) {
+            if (frames[f].file && frames[f].dirty) dirty.push_back(f);
+        }
+        std::sort(dirty.begin(), dirty.end(), [&](uint32_t a, uint32_t b) {
+            return keyOf(frames[a].file, frames[a].pageId) < keyOf(frames[b].file, frames[b].pageId);
+        });
+        std::vector<PagedFile*> written;
+        for (uint32_t f : dirty) {
+            PagedFile* file = frames[f].file;
+            if (written.empty() || written.back() != file) written.push_back(file);
+            writeBack(f);
+        }
+        for (PagedFile* file : written) {
+            file->sync();
+        }
+    }
+
+    Stats statistics() {
+        std::lock_guard<std::mutex> lock(poolLatch);
+        return stats;
+    }
+};
+
+inline void PageGuard::markDirty() {
+    pool->markDirty(frame);
+}
+
+inline void PageGuard::release() {
+    if (pool) {
+        pool->unpin(frame);
+        pool = nullptr;
+    }
+}
+
+#endif
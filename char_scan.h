@@ -0,0 +1,214 @@
+#ifndef BOOKSTORE_CHAR_SCAN_H
+#define BOOKSTORE_CHAR_SCAN_H
+
+#include <string_view>
+#include <cstring>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BOOKSTORE_SCAN_X86 1
+#endif
+
+// ==================== Character Scanning ====================
+
+// Character-class checks and single-byte searches over the short strings
+// commands are made of, 32 or 16 bytes at a time. The widest kernel the CPU
+// supports (AVX2, then SSE2, then plain loops) is chosen once at startup.
+// Arguments are at most a few dozen bytes, so the last partial block is
+// copied into a padded buffer instead of being read past the end.
+
+enum CharClass {
+    CHARS_VISIBLE,          // '!' to '~'
+    CHARS_VISIBLE_UNQUOTED, // the same without '"'
+    CHARS_WORD,             // ASCII letters, digits and '_'
+    CHARS_DIGIT             // '0' to '9'
+};
+
+namespace charscan {
+
+// Every class contains it, so it pads partial blocks
+const char PAD = '0';
+
+inline bool inClass(unsigned char c, CharClass cls) {
+    switch (cls) {
+    case CHARS_VISIBLE: return c >= 33 && c <= 126;
+    case CHARS_VISIBLE_UNQUOTED: return c >= 33 && c <= 126 && c != '"';
+    case CHARS_WORD: return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') || c == '_';
+    case CHARS_DIGIT: return c >= '0' && c <= '9';
+    }
+    return false;
+}
+
+inline bool allInScalar(const char* p, size_t n, CharClass cls) {
+    for (size_t i = 0; i < n; i++) {
+        if (!inClass(p[i], cls)) return false;
+    }
+    return true;
+}
+
+inline size_t findScalar(const char* p, size_t n, char c) {
+    const void* hit = memchr(p, c, n);
+    return hit ? static_cast<const char*>(hit) - p : n;
+}
+
+#ifdef BOOKSTORE_SCAN_X86
+
+// Bytes compare as signed, so everything from 0x80 up is below ' ' and
+// falls outside every class
+__attribute__((target("sse2"), always_inline))
+inline __m128i between128(__m128i x, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(low - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8(high + 1)));
+}
+
+__attribute__((target("sse2"), always_inline))
+inline __m128i classMask128(__m128i v, CharClass cls) {
+    switch (cls) {
+    case CHARS_VISIBLE:
+        return between128(v, 33, 126);
+    case CHARS_VISIBLE_UNQUOTED:
+        return _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), between128(v, 33, 126));
+    case CHARS_WORD: {
+        __m128i letters = between128(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        return _mm_or_si128(_mm_or_si128(between128(v, '0', '9'), letters), _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+    }
+    case CHARS_DIGIT:
+        return between128(v, '0', '9');
+    }
+    return _mm_setzero_si128();
+}
+
+__attribute__((target("sse2")))
+inline bool allInSse2(const char* p, size_t n, CharClass cls) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        if (_mm_movemask_epi8(classMask128(v, cls)) != 0xFFFF) return false;
+    }
+    if (i < n) {
+        char tail[16];
+        memset(tail, PAD, sizeof(tail));
+        memcpy(tail, p + i, n - i);
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail));
+        if (_mm_movemask_epi8(classMask128(v, cls)) != 0xFFFF) return false;
+    }
+    return true;
+}
+
+__attribute__((target("sse2")))
+inline size_t findSse2(const char* p, size_t n, char c) {
+    __m128i needle = _mm_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (hits) return i + __builtin_ctz(hits);
+    }
+    if (i < n) {
+        char tail[16] = {};
+        memcpy(tail, p + i, n - i);
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tail));
+        unsigned hits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)) & ((1u << (n - i)) - 1);
+        if (hits) return i + __builtin_ctz(hits);
+    }
+    return n;
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i between256(__m256i x, char low, char high) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(low - 1)),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(high + 1), x));
+}
+
+__attribute__((target("avx2"), always_inline))
+inline __m256i classMask256(__m256i v, CharClass cls) {
+    switch (cls) {
+    case CHARS_VISIBLE:
+        return between256(v, 33, 126);
+    case CHARS_VISIBLE_UNQUOTED:
+        return _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), between256(v, 33, 126));
+    case CHARS_WORD: {
+        __m256i letters = between256(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        return _mm256_or_si256(_mm256_or_si256(between256(v, '0', '9'), letters),
+                               _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+    }
+    case CHARS_DIGIT:
+        return between256(v, '0', '9');
+    }
+    return _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2")))
+inline bool allInAvx2(const char* p, size_t n, CharClass cls) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        if ((unsigned)_mm256_movemask_epi8(classMask256(v, cls)) != 0xFFFFFFFFu) return false;
+    }
+    if (i < n) {
+        char tail[32];
+        memset(tail, PAD, sizeof(tail));
+        memcpy(tail, p + i, n - i);
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+        if ((unsigned)_mm256_movemask_epi8(classMask256(v, cls)) != 0xFFFFFFFFu) return false;
+    }
+    return true;
+}
+
+__attribute__((target("avx2")))
+inline size_t findAvx2(const char* p, size_t n, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        unsigned hits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (hits) return i + __builtin_ctz(hits);
+    }
+    if (i < n) {
+        char tail[32] = {};
+        memcpy(tail, p + i, n - i);
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail));
+        unsigned hits = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)) & (0xFFFFFFFFu >> (32 - (n - i)));
+        if (hits) return i + __builtin_ctz(hits);
+    }
+    return n;
+}
+
+#endif
+
+struct Kernels {
+    bool (*allIn)(const char* p, size_t n, CharClass cls);
+    size_t (*find)(const char* p, size_t n, char c); // n if absent
+    const char* name;
+};
+
+inline Kernels pickKernels() {
+#ifdef BOOKSTORE_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Kernels{allInAvx2, findAvx2, "avx2"};
+    if (__builtin_cpu_supports("sse2")) return Kernels{allInSse2, findSse2, "sse2"};
+#endif
+    return Kernels{allInScalar, findScalar, "scalar"};
+}
+
+inline const Kernels kernels = pickKernels();
+
+} // namespace charscan
+
+// True if every character of `s` is in `cls`; true for an empty string
+inline bool allInClass(std::string_view s, CharClass cls) {
+    return charscan::kernels.allIn(s.data(), s.size(), cls);
+}
+
+// Position of the first `c` in `s` at or after `from`, or npos
+inline size_t findChar(std::string_view s, char c, size_t from = 0) {
+    if (from >= s.size()) return std::string_view::npos;
+    size_t at = from + charscan::kernels.find(s.data() + from, s.size() - from, c);
+    return at < s.size() ? at : std::string_view::npos;
+}
+
+// Which kernels were chosen: "avx2", "sse2" or "scalar"
+inline const char* scanKernelName() {
+    return charscan::kernels.name;
+}
+
+#endif
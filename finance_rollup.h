@@ -0,0 +1,118 @@
+#ifndef BOOKSTORE_FINANCE_ROLLUP_H
+#define BOOKSTORE_FINANCE_ROLLUP_H
+
+#include <string>
+#include <cstdint>
+#include "fixed_string.h"
+#include "money.h"
+#include "bplus_tree.h"
+
+// ==================== Finance Rollup ====================
+
+// Per-hour and per-day totals of the ledger, updated as each transaction
+// is appended, so reports over any time range read one record per bucket.
+// Each bucket also tracks the best-selling ISBNs by income with the
+// space-saving algorithm: TOP_ISBNS counters, where an untracked ISBN
+// takes over the smallest counter and inherits its value. Every ISBN whose
+// true income exceeds 1/TOP_ISBNS of the bucket total is guaranteed to be
+// tracked; tracked incomes may be overestimated by at most that share.
+class FinanceRollup {
+public:
+    static const int64_t HOUR = 3600;
+    static const int64_t DAY = 86400;
+    static const int TOP_ISBNS = 8;
+
+    typedef FixedString<21> ISBNKey;
+
+    struct TopEntry {
+        ISBNKey isbn; // empty while the slot is unused
+        Money income;
+    };
+
+    struct Bucket {
+        int64_t start; // seconds since the epoch, a multiple of the span
+        Money income;
+        Money expense;
+        uint32_t sales;
+        uint32_t imports;
+        TopEntry top[TOP_ISBNS];
+
+        Bucket() : start(0), sales(0), imports(0) {}
+    };
+
+private:
+    struct Key {
+        int64_t span;
+        int64_t start;
+
+        Key() : span(0), start(0) {}
+        Key(int64_t s, int64_t t) : span(s), start(t) {}
+
+        bool operator<(const Key& other) const {
+            if (span != other.span) return span < other.span;
+            return start < other.start;
+        }
+
+        bool operator==(const Key& other) const {
+            return span == other.span && start == other.start;
+        }
+    };
+
+    BPlusTree<Key, Bucket> tree;
+
+    static void countSale(Bucket& bucket, const ISBNKey& isbn, const Money& amount) {
+        int smallest = 0;
+        for (int i = 0; i < TOP_ISBNS; i++) {
+            if (bucket.top[i].isbn == isbn) {
+                bucket.top[i].income += amount;
+                return;
+            }
+            if (bucket.top[i].isbn == ISBNKey()) {
+                bucket.top[i].isbn = isbn;
+                bucket.top[i].income = amount;
+                return;
+            }
+            if (bucket.top[i].income < bucket.top[smallest].income) smallest = i;
+        }
+        bucket.top[smallest].isbn = isbn;
+        bucket.top[smallest].income += amount;
+    }
+
+    void add(int64_t span, int64_t timestamp, const ISBNKey& isbn, const Money& amount, bool isIncome) {
+        Key key(span, timestamp - timestamp % span);
+        Bucket bucket;
+        bool known = tree.find(key, bucket);
+        bucket.start = key.start;
+        if (isIncome) {
+            bucket.income += amount;
+            bucket.sales++;
+            countSale(bucket, isbn, amount);
+        } else {
+            bucket.expense += amount;
+            bucket.imports++;
+        }
+        if (known) tree.update(key, bucket);
+        else tree.insert(key, bucket);
+    }
+
+public:
+    FinanceRollup(BufferPool& pool, const std::string& path) : tree(pool, path) {}
+
+    void record(int64_t timestamp, const ISBNKey& isbn, const Money& amount, bool isIncome) {
+        add(HOUR, timestamp, isbn, amount, isIncome);
+        add(DAY, timestamp, isbn, amount, isIncome);
+    }
+
+    // Calls visit(bucket) for every non-empty bucket of `span` (HOUR or
+    // DAY) that starts at or after `from`, oldest first
+    template <class Visitor>
+    void forEach(int64_t span, int64_t from, Visitor visit) {
+        tree.scan(Key(span, from), [&](const Key& key, const Bucket& bucket) {
+            if (key.span != span) return false;
+            visit(bucket);
+            return true;
+        });
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef BOOKSTORE_FIXED_STRING_H
+#define BOOKSTORE_FIXED_STRING_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <algorithm>
+#include <cstdint>
+
+// ==================== Fixed String ====================
+
+// Zero-padded, fixed-capacity string usable as an on-disk key. Because the
+// padding is always zero, memcmp over the whole buffer orders keys exactly
+// like std::string does.
+template <size_t N>
+struct FixedString {
+    char data[N];
+
+    FixedString() {
+        memset(data, 0, N);
+    }
+
+    FixedString(std::string_view s) {
+        memset(data, 0, N);
+        memcpy(data, s.data(), std::min(s.size(), N - 1));
+    }
+
+    FixedString(const std::string& s) : FixedString(std::string_view(s)) {}
+
+    FixedString(const char* s) {
+        memset(data, 0, N);
+        memcpy(data, s, strnlen(s, N - 1));
+    }
+
+    std::string_view view() const {
+        return std::string_view(data, strnlen(data, N));
+    }
+
+    std::string str() const {
+        return std::string(view());
+    }
+
+    bool empty() const {
+        return data[0] == 0;
+    }
+
+    bool operator<(const FixedString& other) const {
+        return memcmp(data, other.data, N) < 0;
+    }
+
+    bool operator==(const FixedString& other) const {
+        return memcmp(data, other.data, N) == 0;
+    }
+
+    bool operator!=(const FixedString& other) const {
+        return !(*this == other);
+    }
+};
+
+// FNV-1a over the whole buffer, for unordered containers
+template <size_t N>
+struct FixedStringHash {
+    size_t operator()(const FixedString<N>& s) const {
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < N; i++) {
+            h = (h ^ (unsigned char)s.data[i]) * 1099511628211ull;
+        }
+        return h;
+    }
+};
+
+#endif
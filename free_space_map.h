@@ -0,0 +1,152 @@
+#ifndef BOOKSTORE_FREE_SPACE_MAP_H
+#define BOOKSTORE_FREE_SPACE_MAP_H
+
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "buffer_pool.h"
+
+// ==================== Free Space Map ====================
+
+// One bit per page of a file, set while the page is free. Structures hand
+// pages they no longer use back here and take the lowest free page before
+// growing the file, so deletes stop leaving permanent holes. The bitmap
+// lives in ordinary pages of the same file; their ids and the number of
+// free pages are part of the owner's header, which the owner writes back
+// after changing them. Pages beyond the bitmap's reach are never reused.
+//
+// Because the map goes through the buffer pool like everything else, it
+// changes at checkpoints together with the structure it describes.
+class FreeSpaceMap {
+public:
+    static const uint32_t MAX_MAP_PAGES = 8;
+    static const uint32_t PAGES_PER_MAP = PAGE_SIZE * 8;
+
+    // Kept in the owner's header page
+    struct State {
+        uint32_t freePages;
+        uint32_t mapPageCount;
+        uint32_t mapPages[MAX_MAP_PAGES];
+    };
+
+private:
+    BufferPool& pool;
+    PagedFile& file;
+    State& state;
+
+    void setBit(uint32_t pageId, bool value) {
+        PageGuard page = pool.fetch(file, state.mapPages[pageId / PAGES_PER_MAP]);
+        uint64_t* words = page.as<uint64_t>();
+        uint32_t bit = pageId % PAGES_PER_MAP;
+        uint64_t mask = 1ull << (bit % 64);
+        if (value) words[bit / 64] |= mask;
+        else words[bit / 64] &= ~mask;
+        page.markDirty();
+    }
+
+public:
+    FreeSpaceMap(BufferPool& bufferPool, PagedFile& f, State& s) : pool(bufferPool), file(f), state(s) {}
+
+    FreeSpaceMap(const FreeSpaceMap&) = delete;
+    FreeSpaceMap& operator=(const FreeSpaceMap&) = delete;
+
+    uint32_t freePages() const {
+        return state.freePages;
+    }
+
+    bool isMapPage(uint32_t pageId) const {
+        for (uint32_t i = 0; i < state.mapPageCount; i++) {
+            if (state.mapPages[i] == pageId) return true;
+        }
+        return false;
+    }
+
+    bool isFree(uint32_t pageId) {
+        uint32_t m = pageId / PAGES_PER_MAP;
+        if (state.freePages == 0 || m >= state.mapPageCount) return false;
+        PageGuard page = pool.fetch(file, state.mapPages[m]);
+        uint32_t bit = pageId % PAGES_PER_MAP;
+        return page.as<uint64_t>()[bit / 64] >> (bit % 64) & 1;
+    }
+
+    // Takes the lowest free page below `limit` out of the map; 0 if there
+    // is none. Bits left over for pages past the end of the file (a crash
+    // between trimTail() and the next checkpoint) are dropped on the way.
+    uint32_t takeLowest(uint32_t limit) {
+        for (uint32_t m = 0; m < state.mapPageCount && state.freePages > 0; m++) {
+            PageGuard page = pool.fetch(file, state.mapPages[m]);
+            uint64_t* words = page.as<uint64_t>();
+            for (uint32_t w = 0; w < PAGE_SIZE / sizeof(uint64_t); w++) {
+                while (words[w] != 0) {
+                    uint32_t pageId = m * PAGES_PER_MAP + w * 64 + __builtin_ctzll(words[w]);
+                    if (pageId >= limit && pageId < file.pageCount()) return 0;
+                    words[w] &= words[w] - 1;
+                    page.markDirty();
+                    state.freePages--;
+                    if (pageId < file.pageCount()) return pageId;
+                }
+            }
+        }
+        return 0;
+    }
+
+    // A zeroed page: the lowest free one, or a new one at the end of the file
+    PageGuard allocate() {
+        uint32_t pageId = takeLowest(UINT32_MAX);
+        if (pageId == 0) return pool.allocate(file);
+        PageGuard page = pool.fetch(file, pageId);
+        memset(page.data(), 0, PAGE_SIZE);
+        page.markDirty();
+        return page;
+    }
+
+    void release(uint32_t pageId) {
+        uint32_t m = pageId / PAGES_PER_MAP;
+        if (m >= MAX_MAP_PAGES) return;
+        while (state.mapPageCount <= m) {
+            PageGuard page = pool.allocate(file);
+            state.mapPages[state.mapPageCount++] = page.pageId();
+        }
+        setBit(pageId, true);
+        state.freePages++;
+    }
+
+    // Highest page in use other than the header page; 0 if there is none
+    uint32_t lastUsedPage() {
+        uint32_t pageId = file.pageCount();
+        while (pageId > 1 && isFree(pageId - 1)) pageId--;
+        return pageId - 1;
+    }
+
+    // Moves a bitmap page to `target`; false if `pageId` is not one
+    bool moveMapPage(uint32_t pageId, uint32_t target) {
+        for (uint32_t i = 0; i < state.mapPageCount; i++) {
+            if (state.mapPages[i] != pageId) continue;
+            PageGuard from = pool.fetch(file, pageId);
+            PageGuard to = pool.fetch(file, target);
+            memcpy(to.data(), from.data(), PAGE_SIZE);
+            to.markDirty();
+            state.mapPages[i] = target;
+            return true;
+        }
+        return false;
+    }
+
+    // Shortens the file by its trailing free pages. Only safe right after
+    // a checkpoint: until then the last durable state may still use them.
+    bool trimTail() {
+        uint32_t count = file.pageCount();
+        uint32_t keep = count;
+        while (keep > 1 && isFree(keep - 1)) {
+            setBit(keep - 1, false);
+            state.freePages--;
+            keep--;
+        }
+        if (keep == count) return false;
+        pool.discard(file, keep);
+        file.truncate(keep);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,397 @@
+#ifndef BOOKSTORE_HASH_FILE_H
+#define BOOKSTORE_HASH_FILE_H
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "buffer_pool.h"
+#include "free_space_map.h"
+
+// ==================== Extendible Hash File ====================
+
+// Disk-resident extendible hash table of fixed-size records. Page 0 holds
+// the header, including the list of directory pages; the directory maps
+// the low `globalDepth` bits of a key's hash to a bucket page. A lookup
+// therefore reads one directory page and one bucket page, and an update
+// rewrites the record in place.
+//
+// A full bucket splits in two on its next hash bit, doubling the directory
+// first when the bucket already uses every directory bit. Erase does not
+// merge buckets; compactStep() does that later, a little at a time, along
+// with halving the directory and moving pages from the end of the file
+// into free pages further forward so the file can shrink.
+template <class Key, class Value>
+class ExtendibleHash {
+private:
+    static const uint32_t MAGIC = 0x31485845; // "EXH1"
+    static constexpr uint32_t DIR_PER_PAGE = PAGE_SIZE / sizeof(uint32_t);
+    static constexpr uint32_t MAX_DIR_PAGES = (PAGE_SIZE - 24 - sizeof(FreeSpaceMap::State)) / sizeof(uint32_t);
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t globalDepth;
+        uint32_t dirPageCount;
+        uint64_t size;
+        FreeSpaceMap::State freeSpace;
+        uint32_t dirPages[MAX_DIR_PAGES];
+    };
+
+    struct BucketHeader {
+        uint32_t localDepth;
+        uint32_t count;
+    };
+
+    struct Slot {
+        Key key;
+        Value value;
+    };
+
+    static constexpr int BUCKET_MAX = (PAGE_SIZE - sizeof(BucketHeader)) / sizeof(Slot);
+
+    struct Bucket {
+        BucketHeader h;
+        Slot slots[BUCKET_MAX];
+    };
+
+    // Buddy buckets are merged when the result is at most this full
+    static constexpr int MERGE_LIMIT = BUCKET_MAX * 3 / 4;
+    // Directory entries examined per compaction step
+    static const uint64_t COMPACT_BATCH = 256;
+
+    static_assert(BUCKET_MAX >= 2, "hash bucket holds too few records");
+    static_assert(sizeof(Header) <= PAGE_SIZE, "hash header does not fit in a page");
+    static_assert(sizeof(Bucket) <= PAGE_SIZE, "hash bucket does not fit in a page");
+
+    BufferPool& pool;
+    PagedFile file;
+    Header header;
+    FreeSpaceMap freeSpace;
+    uint64_t compactCursor;    // directory entry the next compaction step starts at
+    uint64_t uncheckedEntries; // entries still to examine since the last erase
+
+    void writeHeader() {
+        PageGuard page = pool.fetch(file, 0);
+        memcpy(page.data(), &header, sizeof(header));
+        page.markDirty();
+    }
+
+    // FNV-1a over the key bytes, then a final mix so that every bit of
+    // the result depends on every byte
+    static uint64_t hashKey(const Key& key) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(Key); i++) {
+            h = (h ^ bytes[i]) * 1099511628211ull;
+        }
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    uint64_t directoryIndex(uint64_t hash) const {
+        return hash & ((1ull << header.globalDepth) - 1);
+    }
+
+    uint32_t bucketAt(uint64_t index) {
+        PageGuard page = pool.fetch(file, header.dirPages[index / DIR_PER_PAGE]);
+        return page.as<uint32_t>()[index % DIR_PER_PAGE];
+    }
+
+    void setBucketAt(uint64_t index, uint32_t bucket) {
+        PageGuard page = pool.fetch(file, header.dirPages[index / DIR_PER_PAGE]);
+        page.as<uint32_t>()[index % DIR_PER_PAGE] = bucket;
+        page.markDirty();
+    }
+
+    // Returns the slot holding `key`, or -1
+    static int findSlot(const Bucket* bucket, const Key& key) {
+        for (int i = 0; i < (int)bucket->h.count; i++) {
+            if (bucket->slots[i].key == key) return i;
+        }
+        return -1;
+    }
+
+    // Doubles the directory; the new upper half mirrors the lower half
+    bool doubleDirectory() {
+        uint64_t entries = 1ull << header.globalDepth;
+        if (entries < DIR_PER_PAGE) {
+            PageGuard page = pool.fetch(file, header.dirPages[0]);
+            uint32_t* dir = page.as<uint32_t>();
+            memcpy(dir + entries, dir, entries * sizeof(uint32_t));
+            page.markDirty();
+        } else {
+            uint32_t pages = entries / DIR_PER_PAGE;
+            if (2 * pages > MAX_DIR_PAGES) return false;
+            for (uint32_t i = 0; i < pages; i++) {
+                PageGuard source = pool.fetch(file, header.dirPages[i]);
+                PageGuard copy = freeSpace.allocate();
+                memcpy(copy.data(), source.data(), PAGE_SIZE);
+                header.dirPages[pages + i] = copy.pageId();
+            }
+            header.dirPageCount = 2 * pages;
+        }
+        header.globalDepth++;
+        return true;
+    }
+
+    // Moves the records whose next hash bit is set to a new bucket and
+    // repoints the matching half of the directory entries at it
+    void splitBucket(PageGuard& page) {
+        Bucket* bucket = page.as<Bucket>();
+        uint32_t depth = bucket->h.localDepth;
+        PageGuard newPage = freeSpace.allocate();
+        Bucket* sibling = newPage.as<Bucket>();
+        sibling->h.localDepth = depth + 1;
+        sibling->h.count = 0;
+        bucket->h.localDepth = depth + 1;
+
+        uint64_t low = 0;
+        int kept = 0;
+        for (int i = 0; i < (int)bucket->h.count; i++) {
+            uint64_t hash = hashKey(bucket->slots[i].key);
+            low = hash & ((1ull << depth) - 1);
+            if (hash >> depth & 1) {
+                sibling->slots[sibling->h.count++] = bucket->slots[i];
+            } else {
+                bucket->slots[kept++] = bucket->slots[i];
+            }
+        }
+        bucket->h.count = kept;
+        page.markDirty();
+
+        uint64_t entries = 1ull << header.globalDepth;
+        for (uint64_t i = low | (1ull << depth); i < entries; i += 1ull << (depth + 1)) {
+            setBucketAt(i, newPage.pageId());
+        }
+    }
+
+    // ---- Compaction ----
+
+    // Folds the bucket at directory entry `index` and its buddy, the bucket
+    // differing only in the highest bit they use, back into one. The
+    // survivor is the one whose entries have that bit clear.
+    bool mergeBuddy(uint64_t index) {
+        uint32_t id = bucketAt(index);
+        PageGuard page = pool.fetch(file, id);
+        Bucket* bucket = page.as<Bucket>();
+        uint32_t depth = bucket->h.localDepth;
+        if (depth == 0) return false;
+        uint64_t bit = 1ull << (depth - 1);
+        uint32_t buddyId = bucketAt(index ^ bit);
+        PageGuard buddyPage = pool.fetch(file, buddyId);
+        Bucket* buddy = buddyPage.as<Bucket>();
+        if (buddyId == id || buddy->h.localDepth != depth) return false;
+        int n = bucket->h.count;
+        int m = buddy->h.count;
+        if (n + m > MERGE_LIMIT && n > 0 && m > 0) return false;
+
+        if (index & bit) {
+            std::swap(page, buddyPage);
+            std::swap(bucket, buddy);
+            std::swap(id, buddyId);
+        }
+        memcpy(&bucket->slots[bucket->h.count], buddy->slots, buddy->h.count * sizeof(Slot));
+        bucket->h.count += buddy->h.count;
+        bucket->h.localDepth = depth - 1;
+        page.markDirty();
+        buddyPage.release();
+
+        uint64_t entries = 1ull << header.globalDepth;
+        for (uint64_t i = index & (bit - 1); i < entries; i += bit) {
+            setBucketAt(i, id);
+        }
+        freeSpace.release(buddyId);
+        return true;
+    }
+
+    // Halves the directory once no bucket uses its highest bit
+    bool halveDirectory() {
+        if (header.globalDepth == 0) return false;
+        uint64_t half = 1ull << (header.globalDepth - 1);
+        for (uint64_t i = 0; i < half; i++) {
+            if (bucketAt(i) != bucketAt(i + half)) return false;
+        }
+        if (half >= DIR_PER_PAGE) {
+            uint32_t pages = header.dirPageCount / 2;
+            for (uint32_t i = pages; i < header.dirPageCount; i++) {
+                freeSpace.release(header.dirPages[i]);
+            }
+            header.dirPageCount = pages;
+        }
+        header.globalDepth--;
+        return true;
+    }
+
+    // Points every directory entry holding bucket `from` at `to`; false if
+    // there were none
+    bool repointBucket(uint32_t from, uint32_t to) {
+        uint64_t entries = 1ull << header.globalDepth;
+        bool found = false;
+        for (uint32_t p = 0; p < header.dirPageCount; p++) {
+            PageGuard page = pool.fetch(file, header.dirPages[p]);
+            uint32_t* dir = page.as<uint32_t>();
+            uint64_t count = std::min<uint64_t>(DIR_PER_PAGE, entries - (uint64_t)p * DIR_PER_PAGE);
+            for (uint64_t i = 0; i < count; i++) {
+                if (dir[i] != from) continue;
+                dir[i] = to;
+                found = true;
+            }
+            if (found) page.markDirty();
+        }
+        return found;
+    }
+
+    // Moves the last page in use into the lowest free page before it
+    bool relocateTail() {
+        uint32_t from = freeSpace.lastUsedPage();
+        if (from == 0) return false;
+        uint32_t to = freeSpace.takeLowest(from);
+        if (to == 0) return false;
+        if (!freeSpace.moveMapPage(from, to)) {
+            {
+                PageGuard source = pool.fetch(file, from);
+                PageGuard target = pool.fetch(file, to);
+                memcpy(target.data(), source.data(), PAGE_SIZE);
+                target.markDirty();
+            }
+            bool found = false;
+            for (uint32_t i = 0; i < header.dirPageCount; i++) {
+                if (header.dirPages[i] != from) continue;
+                header.dirPages[i] = to;
+                found = true;
+            }
+            // Nothing points at it, so it was never really in use
+            if (!found && !repointBucket(from, to)) freeSpace.release(to);
+        }
+        freeSpace.release(from);
+        return true;
+    }
+
+public:
+    ExtendibleHash(BufferPool& bufferPool, const std::string& path)
+        : pool(bufferPool), file(path), freeSpace(pool, file, header.freeSpace),
+          compactCursor(0), uncheckedEntries(UINT64_MAX) {
+        if (file.pageCount() == 0) {
+            pool.allocate(file);
+        }
+        memcpy(&header, pool.fetch(file, 0).data(), sizeof(header));
+        if (!checkFormat(&header, MAGIC, path)) {
+            memset(&header, 0, sizeof(header));
+            header.magic = MAGIC;
+            header.version = FORMAT_VERSION;
+            PageGuard dir = pool.allocate(file);
+            PageGuard bucket = pool.allocate(file);
+            bucket.as<Bucket>()->h.localDepth = 0;
+            bucket.as<Bucket>()->h.count = 0;
+            dir.as<uint32_t>()[0] = bucket.pageId();
+            header.dirPageCount = 1;
+            header.dirPages[0] = dir.pageId();
+            writeHeader();
+        }
+    }
+
+    uint64_t size() const {
+        return header.size;
+    }
+
+    bool empty() const {
+        return header.size == 0;
+    }
+
+    bool contains(const Key& key) {
+        Value value;
+        return find(key, value);
+    }
+
+    bool find(const Key& key, Value& value) {
+        PageGuard page = pool.fetch(file, bucketAt(directoryIndex(hashKey(key))));
+        const Bucket* bucket = page.as<Bucket>();
+        int slot = findSlot(bucket, key);
+        if (slot < 0) return false;
+        value = bucket->slots[slot].value;
+        return true;
+    }
+
+    // Overwrites the value of an existing key in place
+    bool update(const Key& key, const Value& value) {
+        PageGuard page = pool.fetch(file, bucketAt(directoryIndex(hashKey(key))));
+        Bucket* bucket = page.as<Bucket>();
+        int slot = findSlot(bucket, key);
+        if (slot < 0) return false;
+        bucket->slots[slot].value = value;
+        page.markDirty();
+        return true;
+    }
+
+    // Returns false if the key is already present
+    bool insert(const Key& key, const Value& value) {
+        uint64_t hash = hashKey(key);
+        while (true) {
+            PageGuard page = pool.fetch(file, bucketAt(directoryIndex(hash)));
+            Bucket* bucket = page.as<Bucket>();
+            if (findSlot(bucket, key) >= 0) return false;
+            if ((int)bucket->h.count < BUCKET_MAX) {
+                Slot& slot = bucket->slots[bucket->h.count++];
+                slot.key = key;
+                slot.value = value;
+                page.markDirty();
+                break;
+            }
+            if (bucket->h.localDepth == header.globalDepth && !doubleDirectory()) return false;
+            splitBucket(page);
+        }
+        header.size++;
+        writeHeader();
+        return true;
+    }
+
+    bool erase(const Key& key) {
+        PageGuard page = pool.fetch(file, bucketAt(directoryIndex(hashKey(key))));
+        Bucket* bucket = page.as<Bucket>();
+        int slot = findSlot(bucket, key);
+        if (slot < 0) return false;
+        bucket->slots[slot] = bucket->slots[--bucket->h.count];
+        page.markDirty();
+        header.size--;
+        writeHeader();
+        uncheckedEntries = UINT64_MAX;
+        return true;
+    }
+
+    // Does one bounded piece of compaction; false once there is nothing
+    // left to do. Like insert and erase, it needs the table to itself.
+    bool compactStep() {
+        if (uncheckedEntries > 0) {
+            uint64_t entries = 1ull << header.globalDepth;
+            uncheckedEntries = std::min(uncheckedEntries, entries);
+            for (uint64_t k = 0; k < COMPACT_BATCH && uncheckedEntries > 0; k++) {
+                if (compactCursor >= entries) compactCursor = 0;
+                if (mergeBuddy(compactCursor)) {
+                    // The merged bucket may fold again
+                    writeHeader();
+                    return true;
+                }
+                compactCursor++;
+                uncheckedEntries--;
+            }
+            return true;
+        }
+        if (!halveDirectory() && !relocateTail()) return false;
+        writeHeader();
+        return true;
+    }
+
+    // Gives the free pages at the end of the file back to the file system;
+    // only right after a checkpoint
+    bool trimFreeTail() {
+        if (!freeSpace.trimTail()) return false;
+        writeHeader();
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef BOOKSTORE_LATCH_TABLE_H
+#define BOOKSTORE_LATCH_TABLE_H
+
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+// ==================== Latch Table ====================
+
+// Fixed set of mutexes shared out among keys by hash, so that work on one
+// key is serialized without a latch per key. Two keys in the same stripe
+// wait for each other; with STRIPES latches that is rare.
+template <class Key>
+class LatchTable {
+private:
+    static const size_t STRIPES = 64;
+
+    std::mutex latches[STRIPES];
+
+    // FNV-1a over the key bytes; keys must be zero-padded
+    static size_t stripeOf(const Key& key) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+        uint64_t h = 14695981039346656037ull;
+        for (size_t i = 0; i < sizeof(Key); i++) {
+            h = (h ^ bytes[i]) * 1099511628211ull;
+        }
+        return (h ^ h >> 32) % STRIPES;
+    }
+
+public:
+    std::mutex& forKey(const Key& key) {
+        return latches[stripeOf(key)];
+    }
+};
+
+#endif
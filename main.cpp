@@ -2,111 +2,154 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <map>
-#include <set>
-#include <stack>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <memory>
 #include <algorithm>
 #include <cstring>
-#include <iomanip>
 #include <cmath>
+#include <ctime>
+#include "fixed_string.h"
+#include "money.h"
+#include "buffer_pool.h"
+#include "bplus_tree.h"
+#include "text_heap.h"
+#include "record_file.h"
+#include "hash_file.h"
+#include "wal.h"
+#include "secondary_index.h"
+#include "output_buffer.h"
+#include "op_log.h"
+#include "finance_rollup.h"
+#include "server.h"
+#include "latch_table.h"
+#include "version_store.h"
+#include "stats.h"
+#include "arena.h"
+#include "char_scan.h"
 
 using namespace std;
 
 // ==================== Utility Functions ====================
 
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(' ');
-    if (first == string::npos) return "";
-    size_t last = str.find_last_not_of(' ');
-    return str.substr(first, last - first + 1);
-}
-
-vector<string> split(const string& str) {
-    vector<string> result;
-    string current;
-    bool inQuote = false;
-    
-    for (char c : str) {
-        if (c == '"') {
-            inQuote = !inQuote;
-            current += c; // Keep the quote
-        } else if (c == ' ' && !inQuote) {
-            if (!current.empty()) {
-                result.push_back(current);
-                current.clear();
+// Splits a command line on spaces into views of `line`, finding spaces
+// and quotes with the char_scan.h kernels. A space inside double quotes
+// does not split and the quotes stay in the token. `out` is reused across calls, so tokenizing allocates nothing
+// once its capacity has grown.
+void tokenize(string_view line, vector<string_view>& out) {
+    out.clear();
+    size_t n = line.size();
+    size_t i = 0;
+    while (i < n) {
+        while (i < n && line[i] == ' ') i++;
+        if (i == n) break;
+        size_t start = i;
+        // Jump from quote to quote; spaces between a pair do not split
+        while (true) {
+            size_t space = findChar(line, ' ', i);
+            size_t quote = findChar(line, '"', i);
+            if (quote >= space) {
+                i = min(space, n);
+                break;
             }
-        } else {
-            current += c;
+            size_t close = findChar(line, '"', quote + 1);
+            if (close == string_view::npos) {
+                i = n;
+                break;
+            }
+            i = close + 1;
         }
+        out.push_back(line.substr(start, i - start));
     }
-    
-    if (!current.empty()) {
-        result.push_back(current);
+}
+
+// Calls visit(segment) for each '|'-separated segment of a keyword list
+template <class Visitor>
+void forEachKeyword(string_view s, Visitor visit) {
+    if (s.empty()) return;
+    size_t start = 0;
+    while (true) {
+        size_t bar = findChar(s, '|', start);
+        if (bar == string_view::npos) {
+            visit(s.substr(start));
+            return;
+        }
+        visit(s.substr(start, bar - start));
+        start = bar + 1;
     }
-    
-    return result;
 }
 
-bool isValidUserID(const string& s) {
-    if (s.empty() || s.length() > 30) return false;
+// Parses a string of digits that has already been validated
+long long parseNumber(string_view s) {
+    long long value = 0;
     for (char c : s) {
-        if (!isalnum(c) && c != '_') return false;
+        value = value * 10 + (c - '0');
     }
-    return true;
+    return value;
 }
 
-bool isValidPassword(const string& s) {
+// Whether `segment` is one of the '|'-separated segments of `list`
+bool hasKeyword(string_view list, string_view segment) {
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t bar = findChar(list, '|', start);
+        if (bar == string_view::npos) bar = list.size();
+        if (list.substr(start, bar - start) == segment) return true;
+        start = bar + 1;
+    }
+    return false;
+}
+
+bool isValidUserID(string_view s) {
+    if (s.empty() || s.length() > 30) return false;
+    return allInClass(s, CHARS_WORD);
+}
+
+bool isValidPassword(string_view s) {
     return isValidUserID(s);
 }
 
-bool isValidUsername(const string& s) {
+bool isValidUsername(string_view s) {
     if (s.empty() || s.length() > 30) return false;
-    for (char c : s) {
-        if (c < 33 || c > 126) return false;
-    }
-    return true;
+    return allInClass(s, CHARS_VISIBLE);
 }
 
-bool isValidISBN(const string& s) {
+bool isValidISBN(string_view s) {
     if (s.empty() || s.length() > 20) return false;
-    for (char c : s) {
-        if (c < 33 || c > 126) return false;
-    }
-    return true;
+    return allInClass(s, CHARS_VISIBLE);
 }
 
-bool isValidBookString(const string& s) {
+bool isValidBookString(string_view s) {
     if (s.empty() || s.length() > 60) return false;
-    for (char c : s) {
-        if (c < 33 || c > 126 || c == '"') return false;
-    }
-    return true;
+    return allInClass(s, CHARS_VISIBLE_UNQUOTED);
 }
 
-bool isValidKeyword(const string& s) {
+bool isValidKeyword(string_view s) {
+    // '|' is visible, so the segment separators pass the class check
     if (s.empty() || s.length() > 60) return false;
-    vector<string> parts;
-    string current;
-    for (char c : s) {
-        if (c == '|') {
-            if (current.empty()) return false;
-            parts.push_back(current);
-            current.clear();
-        } else {
-            if (c < 33 || c > 126 || c == '"') return false;
-            current += c;
-        }
-    }
-    if (current.empty()) return false;
-    parts.push_back(current);
+    if (!allInClass(s, CHARS_VISIBLE_UNQUOTED)) return false;
     
-    // Check for duplicates
-    set<string> unique(parts.begin(), parts.end());
-    return unique.size() == parts.size();
+    // At most 30 segments fit in 60 characters; compare them pairwise
+    string_view parts[31];
+    int count = 0;
+    bool ok = true;
+    forEachKeyword(s, [&](string_view part) {
+        if (part.empty()) ok = false;
+        for (int i = 0; i < count; i++) {
+            if (parts[i] == part) ok = false;
+        }
+        if (count < 31) parts[count++] = part;
+    });
+    return ok;
 }
 
-bool isValidPrice(const string& s) {
+bool isValidPrice(string_view s) {
     if (s.empty() || s.length() > 13) return false;
     int dotCount = 0;
     for (size_t i = 0; i < s.length(); i++) {
@@ -120,22 +163,147 @@ bool isValidPrice(const string& s) {
     return true;
 }
 
-bool isValidQuantity(const string& s) {
+bool isValidQuantity(string_view s) {
     if (s.empty() || s.length() > 10) return false;
-    for (char c : s) {
-        if (!isdigit(c)) return false;
-    }
-    return stoll(s) > 0;
+    if (!allInClass(s, CHARS_DIGIT)) return false;
+    return parseNumber(s) > 0;
 }
 
-bool isValidCount(const string& s) {
+bool isValidCount(string_view s) {
     if (s.empty() || s.length() > 10) return false;
-    for (char c : s) {
-        if (!isdigit(c)) return false;
-    }
+    return allInClass(s, CHARS_DIGIT);
+}
+
+// ==================== Argument Parsing ====================
+
+// Book fields that can be given as -field=value arguments
+enum BookField : unsigned {
+    FIELD_ISBN = 1,
+    FIELD_NAME = 2,
+    FIELD_AUTHOR = 4,
+    FIELD_KEYWORD = 8,
+    FIELD_PRICE = 16
+};
+
+struct BookArgs {
+    unsigned present; // BookField bits seen so far
+    string_view isbn;
+    string_view name;
+    string_view author;
+    string_view keyword;
+    Money price;
+    
+    BookArgs() : present(0) {}
+};
+
+// Strips the double quotes around a -name/-author/-keyword value
+bool unquote(string_view& value) {
+    if (value.length() < 2 || value.front() != '"' || value.back() != '"') return false;
+    value = value.substr(1, value.length() - 2);
     return true;
 }
 
+// Recognizes, validates and extracts one -field=value argument. Returns
+// the field it set, or 0 if the argument is malformed, invalid or repeats
+// a field already present.
+unsigned parseBookArg(string_view arg, BookArgs& out) {
+    size_t eq = arg.find('=');
+    if (arg.length() < 2 || arg[0] != '-' || eq == string_view::npos) return 0;
+    string_view field = arg.substr(1, eq - 1);
+    string_view value = arg.substr(eq + 1);
+    
+    unsigned flag = 0;
+    if (field == "ISBN") {
+        if (!isValidISBN(value)) return 0;
+        out.isbn = value;
+        flag = FIELD_ISBN;
+    } else if (field == "name") {
+        if (!unquote(value) || !isValidBookString(value)) return 0;
+        out.name = value;
+        flag = FIELD_NAME;
+    } else if (field == "author") {
+        if (!unquote(value) || !isValidBookString(value)) return 0;
+        out.author = value;
+        flag = FIELD_AUTHOR;
+    } else if (field == "keyword") {
+        if (!unquote(value) || !isValidKeyword(value)) return 0;
+        out.keyword = value;
+        flag = FIELD_KEYWORD;
+    } else if (field == "price") {
+        if (!isValidPrice(value)) return 0;
+        Money::parse(value, out.price);
+        flag = FIELD_PRICE;
+    }
+    
+    if (flag == 0 || (out.present & flag)) return 0;
+    out.present |= flag;
+    return flag;
+}
+
+// ==================== Command Table ====================
+
+enum CommandId {
+    CMD_UNKNOWN,
+    CMD_QUIT,
+    CMD_EXIT,
+    CMD_SU,
+    CMD_LOGOUT,
+    CMD_REGISTER,
+    CMD_PASSWD,
+    CMD_USERADD,
+    CMD_DELETE,
+    CMD_SHOW,
+    CMD_BUY,
+    CMD_SELECT,
+    CMD_MODIFY,
+    CMD_IMPORT,
+    CMD_REPORT,
+    CMD_LOG,
+    CMD_STATS
+};
+
+const string_view COMMAND_NAMES[] = {
+    "", "quit", "exit", "su", "logout", "register", "passwd", "useradd",
+    "delete", "show", "buy", "select", "modify", "import", "report", "log", "stats"
+};
+const size_t COMMAND_COUNT = sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]);
+
+// Length and first character tell every command apart. A collision
+// between two commands shows up as a duplicate case label at compile time.
+constexpr unsigned commandHash(string_view s) {
+    return s.empty() ? 0 : (unsigned)s.length() << 8 | (unsigned char)s[0];
+}
+
+CommandId lookupCommand(string_view s) {
+    CommandId id = CMD_UNKNOWN;
+    switch (commandHash(s)) {
+    case commandHash("quit"): id = CMD_QUIT; break;
+    case commandHash("exit"): id = CMD_EXIT; break;
+    case commandHash("su"): id = CMD_SU; break;
+    case commandHash("logout"): id = CMD_LOGOUT; break;
+    case commandHash("register"): id = CMD_REGISTER; break;
+    case commandHash("passwd"): id = CMD_PASSWD; break;
+    case commandHash("useradd"): id = CMD_USERADD; break;
+    case commandHash("delete"): id = CMD_DELETE; break;
+    case commandHash("show"): id = CMD_SHOW; break;
+    case commandHash("buy"): id = CMD_BUY; break;
+    case commandHash("select"): id = CMD_SELECT; break;
+    case commandHash("modify"): id = CMD_MODIFY; break;
+    case commandHash("import"): id = CMD_IMPORT; break;
+    case commandHash("report"): id = CMD_REPORT; break;
+    case commandHash("log"): id = CMD_LOG; break;
+    case commandHash("stats"): id = CMD_STATS; break;
+    }
+    return COMMAND_NAMES[id] == s ? id : CMD_UNKNOWN;
+}
+
+// Replaces a zero-padded char field with `s`, truncated to fit
+template <size_t N>
+void assignField(char (&field)[N], string_view s) {
+    memset(field, 0, N);
+    s.copy(field, N - 1);
+}
+
 // ==================== Data Structures ====================
 
 struct Account {
@@ -151,10 +319,10 @@ struct Account {
         privilege = 0;
     }
     
-    Account(const string& uid, const string& pwd, const string& uname, int priv) {
-        strcpy(userID, uid.c_str());
-        strcpy(password, pwd.c_str());
-        strcpy(username, uname.c_str());
+    Account(string_view uid, string_view pwd, string_view uname, int priv) : Account() {
+        uid.copy(userID, sizeof(userID) - 1);
+        pwd.copy(password, sizeof(password) - 1);
+        uname.copy(username, sizeof(username) - 1);
         privilege = priv;
     }
 };
@@ -164,7 +332,7 @@ struct Book {
     char name[61];
     char author[61];
     char keyword[61];
-    double price;
+    Money price;
     long long quantity;
     
     Book() {
@@ -172,272 +340,824 @@ struct Book {
         memset(name, 0, sizeof(name));
         memset(author, 0, sizeof(author));
         memset(keyword, 0, sizeof(keyword));
-        price = 0.0;
         quantity = 0;
     }
 };
 
+// The part of a book that buy and import read and write
+struct BookStock {
+    Money price;
+    long long quantity;
+    
+    BookStock() : quantity(0) {}
+};
+
+// How a book is stored: its stock next to its ISBN in the books tree, and
+// its name, author and keyword in the text heap
+struct BookRecord {
+    BookStock stock;
+    TextHeap::Ref text; // empty while all three are empty
+};
+
+// A book's text as stored in the heap: the lengths of name, author and
+// keyword, then their characters
+const size_t BOOK_TEXT_BYTES = 3 + 3 * 60;
+
+size_t packBookText(const Book& book, char* out) {
+    const char* fields[] = {book.name, book.author, book.keyword};
+    size_t length = 3;
+    for (int i = 0; i < 3; i++) {
+        size_t n = strlen(fields[i]);
+        out[i] = (char)n;
+        memcpy(out + length, fields[i], n);
+        length += n;
+    }
+    return length == 3 ? 0 : length;
+}
+
+// Views of name, author and keyword in a packed text of `length` bytes
+void splitBookText(const char* bytes, size_t length, string_view fields[3]) {
+    size_t at = 3;
+    for (int i = 0; i < 3; i++) {
+        size_t n = length > 0 ? (unsigned char)bytes[i] : 0;
+        fields[i] = string_view(bytes + at, n);
+        at += n;
+    }
+}
+
+void unpackBookText(const char* bytes, size_t length, Book& book) {
+    string_view fields[3];
+    splitBookText(bytes, length, fields);
+    assignField(book.name, fields[0]);
+    assignField(book.author, fields[1]);
+    assignField(book.keyword, fields[2]);
+}
+
+typedef FixedString<21> ISBNKey;
+typedef FixedString<31> UserKey;
+
+// One ledger entry. Each entry also carries the running totals of every
+// entry up to and including itself, so the sum over the last N entries is
+// the difference of two records.
 struct Transaction {
-    double amount;
+    Money amount;
     bool isIncome; // true for income (buy), false for expense (import)
+    Money totalIncome;
+    Money totalExpense;
     
-    Transaction(double amt, bool income) : amount(amt), isIncome(income) {}
+    Transaction() : isIncome(false) {}
+};
+
+// Work done by one user, kept up to date as each command commits
+struct EmployeeStats {
+    long long operations;
+    long long selects;
+    long long modifies;
+    long long imports;
+    long long importedQuantity;
+    Money importCost;
+    long long sales;
+    long long soldQuantity;
+    Money salesIncome;
+    
+    EmployeeStats()
+        : operations(0), selects(0), modifies(0), imports(0), importedQuantity(0),
+          sales(0), soldQuantity(0) {}
+};
+
+// Commands recorded in the operation log
+enum LogOp : uint8_t {
+    LOG_SU = 1,
+    LOG_LOGOUT,
+    LOG_REGISTER,
+    LOG_PASSWD,
+    LOG_USERADD,
+    LOG_DELETE,
+    LOG_SHOW,
+    LOG_BUY,
+    LOG_SELECT,
+    LOG_MODIFY,
+    LOG_IMPORT,
+    LOG_SHOW_FINANCE,
+    LOG_REPORT_FINANCE,
+    LOG_REPORT_EMPLOYEE,
+    LOG_LOG
 };
 
-struct LogEntry {
-    string operation;
-    string userID;
-    string details;
+const string_view LOG_OP_NAMES[] = {
+    "", "su", "logout", "register", "passwd", "useradd", "delete", "show", "buy",
+    "select", "modify", "import", "show finance", "report finance",
+    "report employee", "log"
+};
+
+// One redo log entry per command. It carries the resolved effect of the
+// command rather than its text, so replay needs no session state.
+struct RedoRecord {
+    enum Op : uint32_t {
+        ADD_ACCOUNT = 1, // register, useradd
+        SET_PASSWORD,    // passwd
+        DELETE_ACCOUNT,  // delete
+        CREATE_BOOK,     // select of an unknown ISBN
+        MODIFY_BOOK,     // modify
+        BUY,             // buy: the stock change
+        IMPORT,          // import: the stock change
+        APPEND_LOG,      // every successful command
+        APPEND_TRANSACTION // buy, import: the ledger entry
+    };
+    
+    uint32_t op;
+    OpRecord entry;     // APPEND_LOG only; nothing after it is logged for it
+    Account account;    // the new account, or just userID (and password)
+    ISBNKey isbn;       // target book; the old ISBN for MODIFY_BOOK
+    Book book;          // new contents for MODIFY_BOOK
+    long long quantity;
+    Money amount;
+    int64_t timestamp;  // APPEND_TRANSACTION, for the finance rollups
+    bool isIncome;      // APPEND_TRANSACTION
+    
+    RedoRecord() : op(0), quantity(0), timestamp(0), isIncome(false) {}
+    explicit RedoRecord(uint32_t o) : op(o), quantity(0), timestamp(0), isIncome(false) {}
 };
 
 // ==================== Storage System ====================
 
-class BookstoreSystem {
-private:
-    map<string, Account> accounts;
-    map<string, Book> books;
-    vector<Transaction> transactions;
-    vector<LogEntry> logs;
+// Memory cap for the page cache shared by all data files
+const size_t BUFFER_POOL_BYTES = 8 << 20;
+
+// Most mutating commands made durable together by one fdatasync of the
+// log; replies about to be sent force one sooner
+const size_t WAL_GROUP_COMMIT = 64;
+
+// The redo log is folded into the data files once it grows past this size
+// or the buffer pool holds this many dirty pages
+const uint64_t WAL_CHECKPOINT_BYTES = 4 << 20;
+const size_t DIRTY_PAGE_LIMIT = 1024;
+
+// Books read per shared-lock acquisition by snapshot scans
+const size_t SCAN_CHUNK = 256;
+
+// Per-client state: the console, or one connection in server mode. Each
+// client has its own login stack, and so its own selected books.
+struct Client {
+    struct TouchedBook {
+        ISBNKey isbn;
+        bool text; // has a text version as well as a stock version
+    };
     
     struct LoginSession {
-        string userID;
+        UserKey userID;
         int privilege;
-        string selectedISBN;
+        ISBNKey selectedISBN; // empty until a book is selected
         
-        LoginSession(const string& uid, int priv) : userID(uid), privilege(priv), selectedISBN("") {}
+        LoginSession(string_view uid, int priv) : userID(uid), privilege(priv) {}
     };
     
-    stack<LoginSession> loginStack;
+    vector<LoginSession> loginStack; // innermost session last
+    vector<string_view> params;  // tokens of the current command line
+    Arena arena;                 // the current command's temporaries
+    uint64_t ackPosition;        // WAL position the replies so far depend on
+    OutputBuffer out;            // flushed by the caller once its input runs dry
+    
+    // What the current command hands to the commit queue
+    vector<RedoRecord> pendingRedo;   // already applied; only logged at commit
+    vector<RedoRecord> pendingLedger; // ledger entries, appended at commit
+    vector<OpRecord> pendingLog;      // operation log entries
+    vector<TouchedBook> touchedBooks; // books with versions to stamp at commit
+    unique_lock<mutex> bookLatch;     // held by buy/import until the commit
+    Client* nextCommit;               // link in the commit queue
+    bool committed;                   // guarded by the commit mutex
+    
+    explicit Client(int fd) : ackPosition(0), out(fd), nextCommit(nullptr), committed(false) {}
+};
+
+typedef Client::LoginSession LoginSession;
+
+class BookstoreSystem {
+private:
+    // Locks are taken in this order:
+    //  - storageMutex: exclusive for commands that change accounts or the
+    //    shape of the catalog, and for checkpoints; shared for everything
+    //    else, including buy and import, which only change a book's stock
+    //  - bookLatches: one stripe per book, held by buy and import from
+    //    their check of the stock until they commit, so that changes to one
+    //    book commit in the order they were made
+    //  - commitMutex: held by the commit leader while it writes the WAL, the
+    //    ledger, the rollups, the employee counters and the operation log,
+    //    and by reports while they copy the rollups or the counters
+    //  - page latches and the buffer pool's own latch
+    //
+    // loginMutex guards loginCounts only and compactorMutex the compactor's
+    // flags only; neither is held with another lock.
+    //
+    // show, report and log read a snapshot: the ledger and the operation log
+    // up to their published sizes, and books through stockVersions and
+    // textVersions. They take the shared lock only a chunk of books at a
+    // time.
+    shared_mutex storageMutex;
+    LatchTable<ISBNKey> bookLatches;
+    mutex commitMutex;
+    atomic<Client*> commitQueue; // commands waiting for the leader, newest first
+    atomic<bool> checkpointDue;
+    uint64_t commitSeq; // commands committed so far; guarded by commitMutex
+    // Ledger totals including buys and imports not yet committed, so that
+    // one which would overflow them is rejected before it changes anything
+    atomic<long long> bookedIncome;
+    atomic<long long> bookedExpense;
+    SnapshotRegistry snapshots;
+    // Every change to a book saves its stock; changes to its text or to
+    // whether it exists save the whole book as well. The keys with text
+    // versions are therefore always among those with stock versions.
+    VersionStore<ISBNKey, BookStock> stockVersions;
+    VersionStore<ISBNKey, Book> textVersions;
+    CommandStats<COMMAND_COUNT> commandStats;
+    mutex loginMutex;
+    unordered_map<UserKey, int, FixedStringHash<31>> loginCounts; // sessions per user, all clients
+    BufferPool pool;
+    WriteAheadLog wal; // must be opened (and recovered) before the data files
+    ExtendibleHash<UserKey, Account> accounts;
+    BPlusTree<UserKey, EmployeeStats> employeeStats;
+    BPlusTree<ISBNKey, BookRecord> books;
+    TextHeap bookText;
+    SecondaryIndex nameIndex;
+    SecondaryIndex authorIndex;
+    SecondaryIndex keywordIndex;
+    RecordFile<Transaction> transactions;
+    FinanceRollup financeRollup;
+    OperationLog opLog;
+    
+    // Background compaction: after deletes, one step at a time under the
+    // exclusive lock, so commands get in between steps
+    mutex compactorMutex;
+    condition_variable compactorWake;
+    bool compactionRequested; // guarded by compactorMutex
+    atomic<bool> compactorStopping;
+    thread compactor;
     
     bool initialized;
     
-    void saveAccounts() {
-        ofstream out("accounts.dat", ios::binary);
-        int count = accounts.size();
-        out.write((char*)&count, sizeof(count));
-        for (auto& p : accounts) {
-            out.write((char*)&p.second, sizeof(Account));
-        }
+    void saveInitFlag() {
+        ofstream out("init.dat");
+        out << "1";
         out.close();
     }
     
-    void loadAccounts() {
-        ifstream in("accounts.dat", ios::binary);
-        if (!in) return;
-        int count;
-        in.read((char*)&count, sizeof(count));
-        for (int i = 0; i < count; i++) {
-            Account acc;
-            in.read((char*)&acc, sizeof(Account));
-            accounts[acc.userID] = acc;
+    bool checkInitFlag() {
+        ifstream in("init.dat");
+        return in.good();
+    }
+    
+    int getCurrentPrivilege(const Client& client) {
+        if (client.loginStack.empty()) return 0;
+        return client.loginStack.back().privilege;
+    }
+    
+    ISBNKey getSelectedISBN(const Client& client) {
+        if (client.loginStack.empty()) return ISBNKey();
+        return client.loginStack.back().selectedISBN;
+    }
+    
+    void setSelectedISBN(Client& client, string_view isbn) {
+        if (!client.loginStack.empty()) {
+            client.loginStack.back().selectedISBN = isbn;
         }
-        in.close();
     }
     
-    void saveBooks() {
-        ofstream out("books.dat", ios::binary);
-        int count = books.size();
-        out.write((char*)&count, sizeof(count));
-        for (auto& p : books) {
-            out.write((char*)&p.second, sizeof(Book));
+    // Entries stay at zero after the last logout, so logging in and out
+    // again does not allocate
+    void countLogin(const UserKey& userID, int delta) {
+        lock_guard<mutex> lock(loginMutex);
+        loginCounts[userID] += delta;
+    }
+    
+    // Forgets a user about to be deleted; fails while they are logged in
+    bool releaseLoginCount(const UserKey& userID) {
+        lock_guard<mutex> lock(loginMutex);
+        auto it = loginCounts.find(userID);
+        if (it == loginCounts.end()) return true;
+        if (it->second > 0) return false;
+        loginCounts.erase(it);
+        return true;
+    }
+    
+    void unpackBook(const ISBNKey& isbn, const BookRecord& record, Book& book) {
+        memcpy(book.ISBN, isbn.data, sizeof(book.ISBN));
+        book.price = record.stock.price;
+        book.quantity = record.stock.quantity;
+        char text[BOOK_TEXT_BYTES];
+        unpackBookText(text, bookText.read(record.text, text), book);
+    }
+    
+    bool loadBook(const ISBNKey& isbn, Book& book) {
+        BookRecord record;
+        if (!books.find(isbn, record)) return false;
+        unpackBook(isbn, record, book);
+        return true;
+    }
+    
+    // The selected book can disappear when another session on the login
+    // stack renames it; treat that like a fresh book with the old ISBN.
+    Book findSelectedBook(const ISBNKey& isbn) {
+        Book book;
+        if (!loadBook(isbn, book)) {
+            strcpy(book.ISBN, isbn.data);
         }
-        out.close();
+        return book;
     }
     
-    void loadBooks() {
-        ifstream in("books.dat", ios::binary);
-        if (!in) return;
-        int count;
-        in.read((char*)&count, sizeof(count));
-        for (int i = 0; i < count; i++) {
-            Book book;
-            in.read((char*)&book, sizeof(Book));
-            books[book.ISBN] = book;
+    // Writes a whole book; the text is only rewritten if it changed
+    void storeBook(const Book& book) {
+        char text[BOOK_TEXT_BYTES];
+        size_t length = packBookText(book, text);
+        BookRecord record;
+        bool present = books.find(book.ISBN, record);
+        if (present) {
+            char old[BOOK_TEXT_BYTES];
+            size_t oldLength = bookText.read(record.text, old);
+            if (oldLength != length || memcmp(old, text, length) != 0) {
+                bookText.erase(record.text);
+                record.text = bookText.insert(text, length);
+            }
+        } else {
+            record.text = bookText.insert(text, length);
         }
-        in.close();
+        record.stock.price = book.price;
+        record.stock.quantity = book.quantity;
+        if (present) books.update(book.ISBN, record);
+        else books.insert(book.ISBN, record);
     }
     
-    void saveTransactions() {
-        ofstream out("transactions.dat", ios::binary);
-        int count = transactions.size();
-        out.write((char*)&count, sizeof(count));
-        for (auto& t : transactions) {
-            out.write((char*)&t.amount, sizeof(t.amount));
-            out.write((char*)&t.isIncome, sizeof(t.isIncome));
+    void eraseBook(const ISBNKey& isbn) {
+        BookRecord record;
+        if (!books.find(isbn, record)) return;
+        bookText.erase(record.text);
+        books.erase(isbn);
+    }
+    
+    // Moves the secondary index entries of a book from its old field values
+    // to its new ones; only fields that actually changed are touched
+    // Returns true if any index entry was removed
+    bool reindexBook(const Book& before, const Book& after) {
+        bool moved = strcmp(before.ISBN, after.ISBN) != 0;
+        bool removed = false;
+        
+        if (moved || strcmp(before.name, after.name) != 0) {
+            if (before.name[0]) nameIndex.remove(before.name, before.ISBN);
+            if (after.name[0]) nameIndex.add(after.name, after.ISBN);
+            removed |= before.name[0] != 0;
         }
-        out.close();
+        if (moved || strcmp(before.author, after.author) != 0) {
+            if (before.author[0]) authorIndex.remove(before.author, before.ISBN);
+            if (after.author[0]) authorIndex.add(after.author, after.ISBN);
+            removed |= before.author[0] != 0;
+        }
+        if (moved || strcmp(before.keyword, after.keyword) != 0) {
+            forEachKeyword(before.keyword, [&](string_view kw) {
+                keywordIndex.remove(kw, before.ISBN);
+            });
+            forEachKeyword(after.keyword, [&](string_view kw) {
+                keywordIndex.add(kw, after.ISBN);
+            });
+            removed |= before.keyword[0] != 0;
+        }
+        return removed;
     }
     
-    void loadTransactions() {
-        ifstream in("transactions.dat", ios::binary);
-        if (!in) return;
-        int count;
-        in.read((char*)&count, sizeof(count));
-        for (int i = 0; i < count; i++) {
-            double amount;
-            bool isIncome;
-            in.read((char*)&amount, sizeof(amount));
-            in.read((char*)&isIncome, sizeof(isIncome));
-            transactions.push_back(Transaction(amount, isIncome));
+    // Running totals after the first `count` ledger entries
+    Transaction ledgerPrefix(uint64_t count) {
+        Transaction t;
+        if (count > 0) transactions.get(count - 1, t);
+        return t;
+    }
+    
+    void appendTransaction(const RedoRecord& r, bool isIncome) {
+        Transaction t = ledgerPrefix(transactions.size());
+        t.amount = r.amount;
+        t.isIncome = isIncome;
+        // Cannot overflow: bookAmount() admitted the command against these
+        if (isIncome) t.totalIncome += r.amount;
+        else t.totalExpense += r.amount;
+        transactions.append(t);
+        financeRollup.record(r.timestamp, r.isbn, r.amount, isIncome);
+    }
+    
+    void countOperation(const OpRecord& entry) {
+        if (entry.user == UserKey()) return;
+        EmployeeStats stats;
+        bool known = employeeStats.find(entry.user, stats);
+        stats.operations++;
+        switch (entry.opcode) {
+        case LOG_SELECT:
+            stats.selects++;
+            break;
+        case LOG_MODIFY:
+            stats.modifies++;
+            break;
+        case LOG_IMPORT:
+            stats.imports++;
+            stats.importedQuantity += entry.quantity;
+            stats.importCost += entry.amount;
+            break;
+        case LOG_BUY:
+            stats.sales++;
+            stats.soldQuantity += entry.quantity;
+            stats.salesIncome += entry.amount;
+            break;
         }
-        in.close();
+        if (known) employeeStats.update(entry.user, stats);
+        else employeeStats.insert(entry.user, stats);
     }
     
-    void saveInitFlag() {
-        ofstream out("init.dat");
-        out << "1";
-        out.close();
+    // ==================== Redo Actions ====================
+    
+    // Logs a mutation to the WAL and applies it. Recovery replays the same
+    // records through applyRedo.
+    void execute(const RedoRecord& r) {
+        wal.logRedo(&r, sizeof(r));
+        applyRedo(r);
     }
     
-    bool checkInitFlag() {
-        ifstream in("init.dat");
-        return in.good();
+    // Applies a mutation of the client's command now; it reaches the WAL
+    // when the command commits. The books it changes keep their old
+    // versions until no snapshot needs them.
+    void execute(Client& client, const RedoRecord& r) {
+        switch (r.op) {
+        case RedoRecord::CREATE_BOOK:
+            saveBookVersion(client, r.isbn, true);
+            break;
+        case RedoRecord::BUY:
+        case RedoRecord::IMPORT:
+            saveBookVersion(client, r.isbn, false);
+            break;
+        case RedoRecord::MODIFY_BOOK:
+            saveBookVersion(client, r.isbn, true);
+            if (r.isbn != ISBNKey(r.book.ISBN)) saveBookVersion(client, r.book.ISBN, true);
+            break;
+        }
+        applyRedo(r);
+        client.pendingRedo.push_back(r);
+    }
+    
+    // Saves the stock of a book before a change, and its text too when
+    // `withText` is set or the change creates the book
+    void saveBookVersion(Client& client, const ISBNKey& isbn, bool withText) {
+        BookRecord record;
+        bool present = books.find(isbn, record);
+        stockVersions.save(isbn, present, record.stock);
+        withText |= !present;
+        if (withText) {
+            Book before;
+            if (present) unpackBook(isbn, record, before);
+            textVersions.save(isbn, present, before);
+        }
+        client.touchedBooks.push_back(Client::TouchedBook{isbn, withText});
+    }
+    
+    // Adds `amount` to a booked ledger total; false if that would overflow
+    static bool bookAmount(atomic<long long>& total, const Money& amount) {
+        Money current(total.load(memory_order_relaxed)), next;
+        do {
+            if (!current.plus(amount, next)) return false;
+        } while (!total.compare_exchange_weak(current.cents, next.cents, memory_order_relaxed));
+        return true;
+    }
+    
+    // Queues the ledger entry of a buy or import for the commit leader
+    void recordTransaction(Client& client, const RedoRecord& r, bool isIncome) {
+        RedoRecord entry(RedoRecord::APPEND_TRANSACTION);
+        entry.isbn = r.isbn;
+        entry.quantity = r.quantity;
+        entry.amount = r.amount;
+        entry.timestamp = r.timestamp;
+        entry.isIncome = isIncome;
+        client.pendingLedger.push_back(entry);
+    }
+    
+    void applyRedo(const RedoRecord& r) {
+        switch (r.op) {
+        case RedoRecord::ADD_ACCOUNT:
+            accounts.insert(r.account.userID, r.account);
+            break;
+        case RedoRecord::SET_PASSWORD: {
+            Account acc;
+            if (accounts.find(r.account.userID, acc)) {
+                strcpy(acc.password, r.account.password);
+                accounts.update(r.account.userID, acc);
+            }
+            break;
+        }
+        case RedoRecord::DELETE_ACCOUNT:
+            accounts.erase(r.account.userID);
+            requestCompaction();
+            break;
+        case RedoRecord::CREATE_BOOK:
+            books.insert(r.isbn, BookRecord());
+            break;
+        case RedoRecord::MODIFY_BOOK: {
+            Book before = findSelectedBook(r.isbn);
+            bool moved = r.isbn != ISBNKey(r.book.ISBN);
+            if (moved) {
+                eraseBook(r.isbn);
+            }
+            storeBook(r.book);
+            if (reindexBook(before, r.book) || moved) requestCompaction();
+            break;
+        }
+        case RedoRecord::BUY: {
+            BookRecord record;
+            if (books.find(r.isbn, record)) {
+                record.stock.quantity -= r.quantity;
+                books.update(r.isbn, record);
+            }
+            break;
+        }
+        case RedoRecord::IMPORT: {
+            BookRecord record;
+            if (books.find(r.isbn, record)) {
+                record.stock.quantity += r.quantity;
+                books.update(r.isbn, record);
+            } else {
+                record.stock.quantity = r.quantity;
+                books.insert(r.isbn, record);
+            }
+            break;
+        }
+        case RedoRecord::APPEND_LOG:
+            opLog.append(r.entry);
+            countOperation(r.entry);
+            break;
+        case RedoRecord::APPEND_TRANSACTION:
+            appendTransaction(r, r.isIncome);
+            break;
+        }
+    }
+    
+    // Queues a log entry; it is appended when the command commits
+    void addLog(Client& client, LogOp op, string_view target = "", long long quantity = 0,
+                Money amount = Money()) {
+        OpRecord entry;
+        entry.timestamp = time(nullptr);
+        if (!client.loginStack.empty()) entry.user = client.loginStack.back().userID;
+        entry.target = target;
+        entry.opcode = op;
+        entry.quantity = quantity;
+        entry.amount = amount;
+        client.pendingLog.push_back(entry);
     }
     
-    int getCurrentPrivilege() {
-        if (loginStack.empty()) return 0;
-        return loginStack.top().privilege;
+    void appendLog(const OpRecord& entry) {
+        RedoRecord r(RedoRecord::APPEND_LOG);
+        r.entry = entry;
+        // The fields after `entry` are unused, so only the prefix is logged
+        wal.logRedo(&r, offsetof(RedoRecord, account));
+        applyRedo(r);
     }
     
-    string getCurrentUserID() {
-        if (loginStack.empty()) return "";
-        return loginStack.top().userID;
+    // ==================== Compaction ====================
+    
+    // True once the dirty pages, or outside a batch the WAL, reach the
+    // checkpoint limits; queued index updates count as the pages they will
+    // dirty
+    bool checkpointNeeded() {
+        size_t dirty = pool.dirtyPages() + nameIndex.pendingUpdates() + authorIndex.pendingUpdates()
+                     + keywordIndex.pendingUpdates();
+        if (dirty >= DIRTY_PAGE_LIMIT) return true;
+        // A batch keeps its log until it ends
+        return !wal.inBatch() && wal.size() >= WAL_CHECKPOINT_BYTES;
     }
     
-    string getSelectedISBN() {
-        if (loginStack.empty()) return "";
-        return loginStack.top().selectedISBN;
+    // Checkpoints, then gives the free pages at the ends of the data files
+    // back to the file system. Trimming rewrites headers and bitmaps, so a
+    // second checkpoint makes the shorter files durable straight away.
+    void checkpoint() {
+        wal.checkpoint(pool);
+        bool trimmed = false;
+        trimmed |= accounts.trimFreeTail();
+        trimmed |= books.trimFreeTail();
+        trimmed |= bookText.trimFreeTail();
+        trimmed |= nameIndex.trimFreeTail();
+        trimmed |= authorIndex.trimFreeTail();
+        trimmed |= keywordIndex.trimFreeTail();
+        if (trimmed) wal.checkpoint(pool);
     }
     
-    void setSelectedISBN(const string& isbn) {
-        if (!loginStack.empty()) {
-            LoginSession session = loginStack.top();
-            loginStack.pop();
-            session.selectedISBN = isbn;
-            loginStack.push(session);
+    void requestCompaction() {
+        {
+            lock_guard<mutex> lock(compactorMutex);
+            compactionRequested = true;
         }
+        compactorWake.notify_one();
     }
     
-    void addLog(const string& op, const string& details = "") {
-        LogEntry entry;
-        entry.operation = op;
-        entry.userID = getCurrentUserID();
-        entry.details = details;
-        logs.push_back(entry);
+    // One step of every structure's compaction; false once none of them
+    // has anything left to do
+    bool compactOnce() {
+        unique_lock<shared_mutex> lock(storageMutex);
+        if (wal.inBatch()) return false;
+        bool busy = false;
+        busy |= accounts.compactStep();
+        busy |= books.compactStep();
+        busy |= nameIndex.compactStep();
+        busy |= authorIndex.compactStep();
+        busy |= keywordIndex.compactStep();
+        // Freed pages at the ends of the files go at the next checkpoint
+        if (pool.dirtyPages() >= DIRTY_PAGE_LIMIT) checkpoint();
+        return busy;
+    }
+    
+    void runCompactor() {
+        unique_lock<mutex> lock(compactorMutex);
+        while (true) {
+            compactorWake.wait(lock, [this] { return compactionRequested || compactorStopping; });
+            if (compactorStopping) return;
+            compactionRequested = false;
+            lock.unlock();
+            while (!compactorStopping && compactOnce()) {
+                this_thread::yield();
+            }
+            lock.lock();
+        }
     }
     
 public:
-    BookstoreSystem() : initialized(false) {
+    BookstoreSystem()
+        : pool(BUFFER_POOL_BYTES),
+          wal("wal.log", WAL_GROUP_COMMIT),
+          accounts(pool, "accounts.dat"),
+          employeeStats(pool, "account_stats.dat"),
+          books(pool, "books.dat"),
+          bookText(pool, "book_text.dat"),
+          nameIndex(pool, "name.idx"),
+          authorIndex(pool, "author.idx"),
+          keywordIndex(pool, "keyword.idx"),
+          transactions(pool, "transactions.dat"),
+          financeRollup(pool, "finance_rollup.dat"),
+          opLog(pool, "oplog.dat", "oplog_user.idx"),
+          compactionRequested(false),
+          initialized(false) {
+        commitQueue = nullptr;
+        checkpointDue = false;
+        compactorStopping = false;
+        commitSeq = 0;
+        // Replay commands logged after the last checkpoint
+        vector<string> redo = wal.takeRecovered();
+        for (auto& payload : redo) {
+            RedoRecord r;
+            memcpy(&r, payload.data(), min(payload.size(), sizeof(r)));
+            applyRedo(r);
+        }
+        if (!redo.empty()) checkpoint();
+        
         if (!checkInitFlag()) {
             // First run - create root account
-            accounts["root"] = Account("root", "sjtu", "root", 7);
-            saveAccounts();
+            RedoRecord r(RedoRecord::ADD_ACCOUNT);
+            r.account = Account("root", "sjtu", "root", 7);
+            execute(r);
+            checkpoint();
             saveInitFlag();
-        } else {
-            loadAccounts();
-            loadBooks();
-            loadTransactions();
         }
+        Transaction totals = ledgerPrefix(transactions.size());
+        bookedIncome = totals.totalIncome.cents;
+        bookedExpense = totals.totalExpense.cents;
+        publishSnapshot();
+        compactor = thread([this] { runCompactor(); });
     }
     
     ~BookstoreSystem() {
-        saveAccounts();
-        saveBooks();
-        saveTransactions();
+        compactorStopping = true;
+        requestCompaction();
+        compactor.join();
+        if (wal.inBatch()) commitBatch();
+        checkpoint();
+    }
+    
+    // ==================== Batch Mode ====================
+    
+    // Commands up to commitBatch() form one atomic unit: the WAL syncs once
+    // at the end, no checkpoint runs in between, and secondary index
+    // updates are applied in key order at commit (or before an index read).
+    // A batch that dirties DIRTY_PAGE_LIMIT pages spills them to the data
+    // files early instead of growing the pool; see relieveBatch().
+    void beginBatch() {
+        wal.beginBatch();
+        nameIndex.deferUpdates(true);
+        authorIndex.deferUpdates(true);
+        keywordIndex.deferUpdates(true);
+    }
+    
+    void commitBatch() {
+        nameIndex.deferUpdates(false);
+        authorIndex.deferUpdates(false);
+        keywordIndex.deferUpdates(false);
+        wal.endBatch();
+    }
+    
+    // Runs when a batch reaches the dirty page limit. Queued index updates
+    // are applied first, as they usually share pages; if the pool is still
+    // over, the dirty pages are written in place under undo images in the
+    // WAL, so a crash before the batch commits still rolls all of it back.
+    void relieveBatch() {
+        nameIndex.applyDeferred();
+        authorIndex.applyDeferred();
+        keywordIndex.applyDeferred();
+        if (pool.dirtyPages() >= DIRTY_PAGE_LIMIT) wal.spill(pool);
     }
     
     // ==================== Account Commands ====================
     
-    bool cmdSu(const vector<string>& params) {
+    bool cmdSu(Client& client, const vector<string_view>& params) {
         if (params.size() < 2 || params.size() > 3) return false;
         
-        string userID = params[1];
-        string password = params.size() == 3 ? params[2] : "";
+        string_view userID = params[1];
+        string_view password = params.size() == 3 ? params[2] : "";
         
         if (!isValidUserID(userID)) return false;
         if (!password.empty() && !isValidPassword(password)) return false;
         
-        if (accounts.find(userID) == accounts.end()) return false;
-        
-        Account& acc = accounts[userID];
+        Account acc;
+        if (!accounts.find(userID, acc)) return false;
         
         if (password.empty()) {
             // Password can be omitted if current privilege is higher
-            if (getCurrentPrivilege() <= acc.privilege) return false;
+            if (getCurrentPrivilege(client) <= acc.privilege) return false;
         } else {
-            if (string(acc.password) != password) return false;
+            if (string_view(acc.password) != password) return false;
         }
         
-        loginStack.push(LoginSession(userID, acc.privilege));
-        addLog("su", userID);
+        client.loginStack.push_back(LoginSession(userID, acc.privilege));
+        countLogin(client.loginStack.back().userID, 1);
+        addLog(client, LOG_SU, userID);
         return true;
     }
     
-    bool cmdLogout(const vector<string>& params) {
+    bool cmdLogout(Client& client, const vector<string_view>& params) {
         if (params.size() != 1) return false;
-        if (getCurrentPrivilege() < 1) return false;
+        if (getCurrentPrivilege(client) < 1) return false;
         
-        string userID = getCurrentUserID();
-        loginStack.pop();
+        UserKey userID = client.loginStack.back().userID;
+        client.loginStack.pop_back();
+        countLogin(userID, -1);
         
-        addLog("logout", userID);
+        addLog(client, LOG_LOGOUT, userID.view());
         return true;
     }
     
-    bool cmdRegister(const vector<string>& params) {
+    bool cmdRegister(Client& client, const vector<string_view>& params) {
         if (params.size() != 4) return false;
         
-        string userID = params[1];
-        string password = params[2];
-        string username = params[3];
+        string_view userID = params[1];
+        string_view password = params[2];
+        string_view username = params[3];
         
         if (!isValidUserID(userID)) return false;
         if (!isValidPassword(password)) return false;
         if (!isValidUsername(username)) return false;
         
-        if (accounts.find(userID) != accounts.end()) return false;
+        if (accounts.contains(userID)) return false;
         
-        accounts[userID] = Account(userID, password, username, 1);
-        addLog("register", userID);
+        RedoRecord r(RedoRecord::ADD_ACCOUNT);
+        r.account = Account(userID, password, username, 1);
+        execute(client, r);
+        addLog(client, LOG_REGISTER, userID);
         return true;
     }
     
-    bool cmdPasswd(const vector<string>& params) {
+    bool cmdPasswd(Client& client, const vector<string_view>& params) {
         if (params.size() < 3 || params.size() > 4) return false;
-        if (getCurrentPrivilege() < 1) return false;
+        if (getCurrentPrivilege(client) < 1) return false;
         
-        string userID = params[1];
-        string currentPassword = params.size() == 4 ? params[2] : "";
-        string newPassword = params.size() == 4 ? params[3] : params[2];
+        string_view userID = params[1];
+        string_view currentPassword = params.size() == 4 ? params[2] : "";
+        string_view newPassword = params.size() == 4 ? params[3] : params[2];
         
         if (!isValidUserID(userID)) return false;
         if (!currentPassword.empty() && !isValidPassword(currentPassword)) return false;
         if (!isValidPassword(newPassword)) return false;
         
-        if (accounts.find(userID) == accounts.end()) return false;
-        
-        Account& acc = accounts[userID];
+        Account acc;
+        if (!accounts.find(userID, acc)) return false;
         
         if (currentPassword.empty()) {
             // Can omit current password if privilege is 7
-            if (getCurrentPrivilege() != 7) return false;
+            if (getCurrentPrivilege(client) != 7) return false;
         } else {
-            if (string(acc.password) != currentPassword) return false;
+            if (string_view(acc.password) != currentPassword) return false;
         }
         
-        strcpy(acc.password, newPassword.c_str());
-        addLog("passwd", userID);
+        RedoRecord r(RedoRecord::SET_PASSWORD);
+        r.account = Account(userID, newPassword, "", acc.privilege);
+        execute(client, r);
+        addLog(client, LOG_PASSWD, userID);
         return true;
     }
     
-    bool cmdUseradd(const vector<string>& params) {
+    bool cmdUseradd(Client& client, const vector<string_view>& params) {
         if (params.size() != 5) return false;
-        if (getCurrentPrivilege() < 3) return false;
+        if (getCurrentPrivilege(client) < 3) return false;
         
-        string userID = params[1];
-        string password = params[2];
-        string privilegeStr = params[3];
-        string username = params[4];
+        string_view userID = params[1];
+        string_view password = params[2];
+        string_view privilegeStr = params[3];
+        string_view username = params[4];
         
         if (!isValidUserID(userID)) return false;
         if (!isValidPassword(password)) return false;
@@ -447,474 +1167,902 @@ public:
         int privilege = privilegeStr[0] - '0';
         if (privilege != 1 && privilege != 3 && privilege != 7) return false;
         
-        if (privilege >= getCurrentPrivilege()) return false;
+        if (privilege >= getCurrentPrivilege(client)) return false;
         
-        if (accounts.find(userID) != accounts.end()) return false;
+        if (accounts.contains(userID)) return false;
         
-        accounts[userID] = Account(userID, password, username, privilege);
-        addLog("useradd", userID);
+        RedoRecord r(RedoRecord::ADD_ACCOUNT);
+        r.account = Account(userID, password, username, privilege);
+        execute(client, r);
+        addLog(client, LOG_USERADD, userID);
         return true;
     }
     
-    bool cmdDelete(const vector<string>& params) {
+    bool cmdDelete(Client& client, const vector<string_view>& params) {
         if (params.size() != 2) return false;
-        if (getCurrentPrivilege() < 7) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
         
-        string userID = params[1];
+        string_view userID = params[1];
         
         if (!isValidUserID(userID)) return false;
         
-        if (accounts.find(userID) == accounts.end()) return false;
+        if (!accounts.contains(userID)) return false;
         
-        // Check if user is logged in
-        stack<LoginSession> tempStack = loginStack;
-        while (!tempStack.empty()) {
-            if (tempStack.top().userID == userID) return false;
-            tempStack.pop();
-        }
+        if (!releaseLoginCount(userID)) return false;
         
-        accounts.erase(userID);
-        addLog("delete", userID);
+        RedoRecord r(RedoRecord::DELETE_ACCOUNT);
+        userID.copy(r.account.userID, sizeof(r.account.userID) - 1);
+        execute(client, r);
+        addLog(client, LOG_DELETE, userID);
         return true;
     }
     
     // ==================== Book Commands ====================
     
-    bool cmdShow(const vector<string>& params) {
-        if (getCurrentPrivilege() < 1) return false;
-        
-        vector<Book> results;
-        
-        if (params.size() == 1) {
-            // Show all books
-            for (auto& p : books) {
-                results.push_back(p.second);
+    // `fields` are the name, author and keyword
+    template <class Text>
+    static void formatBookRow(string_view isbn, const string_view fields[3], const BookStock& stock, Text& text) {
+        char price[32], quantity[24];
+        text += isbn;
+        text += '\t';
+        text += fields[0];
+        text += '\t';
+        text += fields[1];
+        text += '\t';
+        text += fields[2];
+        text += '\t';
+        text += stock.price.format(price);
+        text += '\t';
+        text += OutputBuffer::formatInt(stock.quantity, quantity);
+        text += '\n';
+    }
+    
+    void writeBookRow(Client& client, const Book& book) {
+        char price[32], quantity[24];
+        string_view row[] = {
+            book.ISBN, "\t", book.name, "\t", book.author, "\t", book.keyword, "\t",
+            book.price.format(price), "\t",
+            OutputBuffer::formatInt(book.quantity, quantity), "\n"
+        };
+        client.out.writeFragments(row, sizeof(row) / sizeof(row[0]));
+    }
+    
+    // Turns the live state of a book, read just before, into its state at
+    // snapshot `seq`. A change after the snapshot always left a stock
+    // version; only some left a text version.
+    void rewindBook(const ISBNKey& isbn, uint64_t seq, bool& present, Book& book) {
+        BookStock stock;
+        bool stockPresent = present;
+        if (!stockVersions.find(isbn, seq, stockPresent, stock)) return;
+        textVersions.find(isbn, seq, present, book);
+        present = stockPresent;
+        book.price = stock.price;
+        book.quantity = stock.quantity;
+    }
+    
+    // The book `isbn` as of `snapshot`. The live record is read first and
+    // then replaced by its versions, if it changed after the snapshot.
+    bool findVisibleBook(const Snapshot& snapshot, const ISBNKey& isbn, Book& book) {
+        bool present;
+        {
+            shared_lock<shared_mutex> lock(storageMutex);
+            present = loadBook(isbn, book);
+        }
+        rewindBook(isbn, snapshot.seq, present, book);
+        return present;
+    }
+    
+    // Writes every book of `snapshot` in ISBN order; returns the count.
+    // The tree is read SCAN_CHUNK records at a time under the shared lock,
+    // and the rows are formatted from the text heap before it is released.
+    // Each chunk is merged with the books changed since the snapshot.
+    size_t showVisibleBooks(Client& client, const Snapshot& snapshot) {
+        struct Row {
+            ISBNKey isbn;
+            BookRecord record;
+            size_t end; // offset just past the row in `text`
+        };
+        ArenaVector<Row> chunk{ArenaAllocator<Row>(client.arena)};
+        ArenaVector<ISBNKey> changed{ArenaAllocator<ISBNKey>(client.arena)};
+        ArenaString text{ArenaAllocator<char>(client.arena)};
+        chunk.reserve(SCAN_CHUNK);
+        ISBNKey from;
+        bool first = true;
+        size_t rows = 0;
+        while (true) {
+            chunk.clear();
+            text.clear();
+            {
+                shared_lock<shared_mutex> lock(storageMutex);
+                books.scan(from, [&](const ISBNKey& isbn, const BookRecord& record) {
+                    if (!first && isbn == from) return true;
+                    chunk.push_back(Row{isbn, record, 0});
+                    return chunk.size() < SCAN_CHUNK;
+                });
+                TextHeap::Cursor cursor(bookText);
+                for (Row& row : chunk) {
+                    string_view packed = cursor.read(row.record.text);
+                    string_view fields[3];
+                    splitBookText(packed.data(), packed.size(), fields);
+                    formatBookRow(row.isbn.view(), fields, row.record.stock, text);
+                    row.end = text.size();
+                }
             }
-        } else if (params.size() == 2) {
-            string param = params[1];
+            bool last = chunk.size() < SCAN_CHUNK;
+            changed.clear();
+            stockVersions.keys(from, first, last ? nullptr : &chunk.back().isbn, changed);
+            
+            // Unchanged rows are copied out in runs. A changed book is read
+            // again, which gives its live row back if the change came later.
+            size_t i = 0, j = 0, written = 0;
+            while (i < chunk.size() || j < changed.size()) {
+                if (j == changed.size() || (i < chunk.size() && chunk[i].isbn < changed[j])) {
+                    rows++;
+                    i++;
+                    continue;
+                }
+                bool live = i < chunk.size() && chunk[i].isbn == changed[j];
+                Book book;
+                bool present = findVisibleBook(snapshot, changed[j++], book);
+                size_t begin = i > 0 ? chunk[i - 1].end : 0;
+                client.out.write(string_view(text.data() + written, begin - written));
+                written = live ? chunk[i].end : begin;
+                if (present) {
+                    writeBookRow(client, book);
+                    rows++;
+                }
+                if (live) i++;
+            }
+            client.out.write(string_view(text.data() + written, text.size() - written));
             
-            if (param.substr(0, 6) == "-ISBN=") {
-                string isbn = param.substr(6);
-                if (!isValidISBN(isbn)) return false;
-                if (books.find(isbn) != books.end()) {
-                    results.push_back(books[isbn]);
+            if (last) return rows;
+            from = chunk.back().isbn;
+            first = false;
+        }
+    }
+    
+    // Writes the row of every book of `snapshot` indexed under `value`;
+    // returns the count. The index is read live, so books changed since the
+    // snapshot are added as candidates and every candidate is checked with
+    // `matches`.
+    template <class Match>
+    size_t showIndexed(Client& client, const Snapshot& snapshot, SecondaryIndex& index,
+                       string_view value, Match matches) {
+        ArenaVector<ISBNKey> candidates{ArenaAllocator<ISBNKey>(client.arena)};
+        {
+            shared_lock<shared_mutex> lock(storageMutex);
+            index.forEach(value, [&](const ISBNKey& isbn) {
+                candidates.push_back(isbn);
+            });
+        }
+        ArenaVector<ISBNKey> changed{ArenaAllocator<ISBNKey>(client.arena)};
+        stockVersions.allKeys(changed);
+        if (!changed.empty()) {
+            candidates.insert(candidates.end(), changed.begin(), changed.end());
+            sort(candidates.begin(), candidates.end());
+            candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+        }
+        
+        size_t rows = 0;
+        ArenaVector<pair<bool, Book>> chunk{ArenaAllocator<pair<bool, Book>>(client.arena)};
+        for (size_t start = 0; start < candidates.size(); start += SCAN_CHUNK) {
+            size_t end = min(candidates.size(), start + SCAN_CHUNK);
+            chunk.resize(end - start);
+            {
+                shared_lock<shared_mutex> lock(storageMutex);
+                for (size_t i = start; i < end; i++) {
+                    chunk[i - start].first = loadBook(candidates[i], chunk[i - start].second);
                 }
-            } else if (param.substr(0, 6) == "-name=") {
-                if (param.length() < 9 || param[6] != '"' || param.back() != '"') return false;
-                string name = param.substr(7, param.length() - 8);
-                if (!isValidBookString(name)) return false;
-                for (auto& p : books) {
-                    if (string(p.second.name) == name) {
-                        results.push_back(p.second);
-                    }
+            }
+            for (size_t i = start; i < end; i++) {
+                auto& [present, book] = chunk[i - start];
+                if (binary_search(changed.begin(), changed.end(), candidates[i])) {
+                    rewindBook(candidates[i], snapshot.seq, present, book);
                 }
-            } else if (param.substr(0, 8) == "-author=") {
-                if (param.length() < 11 || param[8] != '"' || param.back() != '"') return false;
-                string author = param.substr(9, param.length() - 10);
-                if (!isValidBookString(author)) return false;
-                for (auto& p : books) {
-                    if (string(p.second.author) == author) {
-                        results.push_back(p.second);
-                    }
+                if (present && matches(book)) {
+                    writeBookRow(client, book);
+                    rows++;
                 }
-            } else if (param.substr(0, 9) == "-keyword=") {
-                if (param.length() < 12 || param[9] != '"' || param.back() != '"') return false;
-                string keyword = param.substr(10, param.length() - 11);
-                if (!isValidBookString(keyword)) return false;
-                // Check for multiple keywords (should have no |)
-                if (keyword.find('|') != string::npos) return false;
-                for (auto& p : books) {
-                    string kws = p.second.keyword;
-                    // Split keywords and check
-                    vector<string> kwList;
-                    string current;
-                    for (char c : kws) {
-                        if (c == '|') {
-                            kwList.push_back(current);
-                            current.clear();
-                        } else {
-                            current += c;
-                        }
-                    }
-                    kwList.push_back(current);
-                    
-                    bool found = false;
-                    for (auto& kw : kwList) {
-                        if (kw == keyword) {
-                            found = true;
-                            break;
-                        }
-                    }
-                    if (found) {
-                        results.push_back(p.second);
-                    }
+            }
+        }
+        return rows;
+    }
+    
+    bool cmdShow(Client& client, const vector<string_view>& params) {
+        if (getCurrentPrivilege(client) < 1) return false;
+        
+        // Rows stream from the B+ tree and the secondary indexes, which all
+        // yield books in ISBN order
+        SnapshotGuard snapshot(snapshots);
+        size_t rows = 0;
+        
+        if (params.size() == 1) {
+            // Show all books
+            rows = showVisibleBooks(client, snapshot.get());
+        } else if (params.size() == 2) {
+            BookArgs args;
+            switch (parseBookArg(params[1], args)) {
+            case FIELD_ISBN: {
+                Book book;
+                if (findVisibleBook(snapshot.get(), args.isbn, book)) {
+                    writeBookRow(client, book);
+                    rows++;
                 }
-            } else {
+                break;
+            }
+            case FIELD_NAME:
+                rows = showIndexed(client, snapshot.get(), nameIndex, args.name, [&](const Book& book) {
+                    return string_view(book.name) == args.name;
+                });
+                break;
+            case FIELD_AUTHOR:
+                rows = showIndexed(client, snapshot.get(), authorIndex, args.author, [&](const Book& book) {
+                    return string_view(book.author) == args.author;
+                });
+                break;
+            case FIELD_KEYWORD: {
+                // Only a single keyword can be searched for
+                if (findChar(args.keyword, '|') != string_view::npos) return false;
+                rows = showIndexed(client, snapshot.get(), keywordIndex, args.keyword, [&](const Book& book) {
+                    return hasKeyword(book.keyword, args.keyword);
+                });
+                break;
+            }
+            default:
                 return false;
             }
         } else {
             return false;
         }
         
-        // Sort by ISBN
-        sort(results.begin(), results.end(), [](const Book& a, const Book& b) {
-            return string(a.ISBN) < string(b.ISBN);
-        });
-        
-        if (results.empty()) {
-            cout << "\n";
-        } else {
-            for (auto& book : results) {
-                cout << book.ISBN << "\t"
-                     << book.name << "\t"
-                     << book.author << "\t"
-                     << book.keyword << "\t"
-                     << fixed << setprecision(2) << book.price << "\t"
-                     << book.quantity << "\n";
-            }
+        if (rows == 0) {
+            client.out << "\n";
         }
         
-        addLog("show");
+        addLog(client, LOG_SHOW);
         return true;
     }
     
-    bool cmdBuy(const vector<string>& params) {
+    bool cmdBuy(Client& client, const vector<string_view>& params) {
         if (params.size() != 3) return false;
-        if (getCurrentPrivilege() < 1) return false;
+        if (getCurrentPrivilege(client) < 1) return false;
         
-        string isbn = params[1];
-        string quantityStr = params[2];
+        string_view isbn = params[1];
+        string_view quantityStr = params[2];
         
         if (!isValidISBN(isbn)) return false;
         if (!isValidQuantity(quantityStr)) return false;
         
-        long long quantity = stoll(quantityStr);
-        
-        if (books.find(isbn) == books.end()) return false;
+        long long quantity = parseNumber(quantityStr);
         
-        Book& book = books[isbn];
-        if (book.quantity < quantity) return false;
+        ISBNKey key(isbn);
+        client.bookLatch = unique_lock<mutex>(bookLatches.forKey(key));
+        BookRecord record;
+        if (!books.find(key, record)) return false;
+        if (record.stock.quantity < quantity) return false;
         
-        double totalCost = book.price * quantity;
-        book.quantity -= quantity;
+        Money totalCost;
+        if (!record.stock.price.times(quantity, totalCost)) return false;
+        if (!bookAmount(bookedIncome, totalCost)) return false;
         
-        transactions.push_back(Transaction(totalCost, true));
+        RedoRecord r(RedoRecord::BUY);
+        r.isbn = isbn;
+        r.quantity = quantity;
+        r.amount = totalCost;
+        r.timestamp = time(nullptr);
+        execute(client, r);
+        recordTransaction(client, r, true);
         
-        cout << fixed << setprecision(2) << totalCost << "\n";
+        client.out << totalCost << "\n";
         
-        addLog("buy", isbn + " " + quantityStr);
+        addLog(client, LOG_BUY, isbn, quantity, totalCost);
         return true;
     }
     
-    bool cmdSelect(const vector<string>& params) {
+    bool cmdSelect(Client& client, const vector<string_view>& params) {
         if (params.size() != 2) return false;
-        if (getCurrentPrivilege() < 3) return false;
+        if (getCurrentPrivilege(client) < 3) return false;
         
-        string isbn = params[1];
+        string_view isbn = params[1];
         
         if (!isValidISBN(isbn)) return false;
         
-        if (books.find(isbn) == books.end()) {
+        if (!books.contains(isbn)) {
             // Create new book
-            Book newBook;
-            strcpy(newBook.ISBN, isbn.c_str());
-            books[isbn] = newBook;
+            RedoRecord r(RedoRecord::CREATE_BOOK);
+            r.isbn = isbn;
+            execute(client, r);
         }
         
-        setSelectedISBN(isbn);
+        setSelectedISBN(client, isbn);
         
-        addLog("select", isbn);
+        addLog(client, LOG_SELECT, isbn);
         return true;
     }
     
-    bool cmdModify(const vector<string>& params) {
+    bool cmdModify(Client& client, const vector<string_view>& params) {
         if (params.size() < 2) return false;
-        if (getCurrentPrivilege() < 3) return false;
+        if (getCurrentPrivilege(client) < 3) return false;
         
-        string isbn = getSelectedISBN();
+        ISBNKey isbn = getSelectedISBN(client);
         if (isbn.empty()) return false;
         
-        set<string> paramTypes;
-        string newISBN = "";
-        string newName = "";
-        string newAuthor = "";
-        string newKeyword = "";
-        double newPrice = -1.0;
-        bool hasName = false, hasAuthor = false, hasKeyword = false, hasPrice = false;
-        
-        // First pass: validate and collect all modifications
+        // Validate and collect all modifications first
+        BookArgs args;
         for (size_t i = 1; i < params.size(); i++) {
-            string param = params[i];
-            
-            if (param.substr(0, 6) == "-ISBN=") {
-                if (paramTypes.count("ISBN")) return false;
-                paramTypes.insert("ISBN");
-                newISBN = param.substr(6);
-                if (!isValidISBN(newISBN)) return false;
-                if (newISBN == isbn) return false; // Cannot change to same ISBN
-                if (books.find(newISBN) != books.end()) return false; // New ISBN already exists
-            } else if (param.substr(0, 6) == "-name=") {
-                if (paramTypes.count("name")) return false;
-                paramTypes.insert("name");
-                if (param.length() < 9 || param[6] != '"' || param.back() != '"') return false;
-                newName = param.substr(7, param.length() - 8);
-                if (!isValidBookString(newName)) return false;
-                hasName = true;
-            } else if (param.substr(0, 8) == "-author=") {
-                if (paramTypes.count("author")) return false;
-                paramTypes.insert("author");
-                if (param.length() < 11 || param[8] != '"' || param.back() != '"') return false;
-                newAuthor = param.substr(9, param.length() - 10);
-                if (!isValidBookString(newAuthor)) return false;
-                hasAuthor = true;
-            } else if (param.substr(0, 9) == "-keyword=") {
-                if (paramTypes.count("keyword")) return false;
-                paramTypes.insert("keyword");
-                if (param.length() < 12 || param[9] != '"' || param.back() != '"') return false;
-                newKeyword = param.substr(10, param.length() - 11);
-                if (!isValidKeyword(newKeyword)) return false;
-                hasKeyword = true;
-            } else if (param.substr(0, 7) == "-price=") {
-                if (paramTypes.count("price")) return false;
-                paramTypes.insert("price");
-                string priceStr = param.substr(7);
-                if (!isValidPrice(priceStr)) return false;
-                newPrice = stod(priceStr);
-                hasPrice = true;
-            } else {
-                return false;
-            }
+            if (!parseBookArg(params[i], args)) return false;
+        }
+        
+        bool hasISBN = args.present & FIELD_ISBN;
+        if (hasISBN) {
+            if (args.isbn == isbn.view()) return false; // Cannot change to same ISBN
+            if (books.contains(args.isbn)) return false; // New ISBN already exists
         }
         
         // Apply modifications
-        Book& book = books[isbn];
+        Book book = findSelectedBook(isbn);
+        
+        if (args.present & FIELD_NAME) assignField(book.name, args.name);
+        if (args.present & FIELD_AUTHOR) assignField(book.author, args.author);
+        if (args.present & FIELD_KEYWORD) assignField(book.keyword, args.keyword);
+        if (args.present & FIELD_PRICE) book.price = args.price;
+        if (hasISBN) assignField(book.ISBN, args.isbn);
         
-        if (hasName) strcpy(book.name, newName.c_str());
-        if (hasAuthor) strcpy(book.author, newAuthor.c_str());
-        if (hasKeyword) strcpy(book.keyword, newKeyword.c_str());
-        if (hasPrice) book.price = newPrice;
+        RedoRecord r(RedoRecord::MODIFY_BOOK);
+        r.isbn = isbn;
+        r.book = book;
+        execute(client, r);
         
-        // Handle ISBN change (must be done after other modifications)
-        if (!newISBN.empty()) {
-            books[newISBN] = book;
-            strcpy(books[newISBN].ISBN, newISBN.c_str());
-            books.erase(isbn);
-            setSelectedISBN(newISBN);
+        if (hasISBN) {
+            setSelectedISBN(client, args.isbn);
         }
         
-        addLog("modify");
+        addLog(client, LOG_MODIFY, book.ISBN);
         return true;
     }
     
-    bool cmdImport(const vector<string>& params) {
+    bool cmdImport(Client& client, const vector<string_view>& params) {
         if (params.size() != 3) return false;
-        if (getCurrentPrivilege() < 3) return false;
+        if (getCurrentPrivilege(client) < 3) return false;
         
-        string isbn = getSelectedISBN();
+        ISBNKey isbn = getSelectedISBN(client);
         if (isbn.empty()) return false;
         
-        string quantityStr = params[1];
-        string totalCostStr = params[2];
+        string_view quantityStr = params[1];
+        string_view totalCostStr = params[2];
         
         if (!isValidQuantity(quantityStr)) return false;
         if (!isValidPrice(totalCostStr)) return false;
         
-        long long quantity = stoll(quantityStr);
-        double totalCost = stod(totalCostStr);
+        long long quantity = parseNumber(quantityStr);
+        Money totalCost;
+        Money::parse(totalCostStr, totalCost);
         
-        if (totalCost <= 0) return false;
+        if (totalCost.cents <= 0) return false;
+        if (!bookAmount(bookedExpense, totalCost)) return false;
         
-        Book& book = books[isbn];
-        book.quantity += quantity;
+        RedoRecord r(RedoRecord::IMPORT);
+        r.isbn = isbn;
+        r.quantity = quantity;
+        r.amount = totalCost;
+        r.timestamp = time(nullptr);
+        client.bookLatch = unique_lock<mutex>(bookLatches.forKey(r.isbn));
+        execute(client, r);
+        recordTransaction(client, r, false);
         
-        transactions.push_back(Transaction(totalCost, false));
-        
-        addLog("import", quantityStr + " " + totalCostStr);
+        addLog(client, LOG_IMPORT, isbn.view(), quantity, totalCost);
         return true;
     }
     
     // ==================== Log Commands ====================
     
-    bool cmdShowFinance(const vector<string>& params) {
+    bool cmdShowFinance(Client& client, const vector<string_view>& params) {
         if (params.size() < 2 || params.size() > 3) return false;
-        if (getCurrentPrivilege() < 7) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
         
         if (params[1] != "finance") return false;
         
-        int count = -1;
+        SnapshotGuard snapshot(snapshots);
+        uint64_t total = snapshot->ledgerSize;
+        uint64_t count = total;
         if (params.size() == 3) {
-            string countStr = params[2];
+            string_view countStr = params[2];
             if (!isValidCount(countStr)) return false;
-            count = stoi(countStr);
+            count = parseNumber(countStr);
             if (count == 0) {
-                cout << "\n";
+                client.out << "\n";
                 return true;
             }
-            if (count > (int)transactions.size()) return false;
+            if (count > total) return false;
         }
         
-        double income = 0.0, expense = 0.0;
+        Transaction last = ledgerPrefix(total);
+        Transaction base = ledgerPrefix(total - count);
+        Money income = last.totalIncome - base.totalIncome;
+        Money expense = last.totalExpense - base.totalExpense;
         
-        int start = 0;
-        if (count != -1) {
-            start = transactions.size() - count;
-        }
+        client.out << "+ " << income << " - " << expense << "\n";
         
-        for (int i = start; i < (int)transactions.size(); i++) {
-            if (transactions[i].isIncome) {
-                income += transactions[i].amount;
-            } else {
-                expense += transactions[i].amount;
+        addLog(client, LOG_SHOW_FINANCE);
+        return true;
+    }
+    
+    // One report row: UTC bucket start, totals, and the top ISBNs by income
+    void writeFinanceBucket(Client& client, const FinanceRollup::Bucket& bucket, const char* timeFormat) {
+        char when[32];
+        time_t start = bucket.start;
+        tm utc;
+        gmtime_r(&start, &utc);
+        size_t whenLength = strftime(when, sizeof(when), timeFormat, &utc);
+        client.out << string_view(when, whenLength)
+            << "  + " << bucket.income << " - " << bucket.expense
+            << "  (" << (long long)bucket.sales << " sales, "
+            << (long long)bucket.imports << " imports)";
+        
+        // Insertion sort of the few tracked ISBNs, highest income first
+        FinanceRollup::TopEntry top[FinanceRollup::TOP_ISBNS];
+        int count = 0;
+        for (auto& entry : bucket.top) {
+            if (entry.isbn == ISBNKey()) continue;
+            int i = count++;
+            while (i > 0 && top[i - 1].income < entry.income) {
+                top[i] = top[i - 1];
+                i--;
             }
+            top[i] = entry;
         }
-        
-        cout << "+ " << fixed << setprecision(2) << income 
-             << " - " << fixed << setprecision(2) << expense << "\n";
-        
-        addLog("show finance");
-        return true;
+        if (count > 0) client.out << "  top:";
+        for (int i = 0; i < count; i++) {
+            client.out << " " << top[i].isbn.view() << " " << top[i].income;
+        }
+        client.out << "\n";
     }
     
-    bool cmdReportFinance(const vector<string>& params) {
+    bool cmdReportFinance(Client& client, const vector<string_view>& params) {
         if (params.size() != 2) return false;
-        if (getCurrentPrivilege() < 7) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
         if (params[1] != "finance") return false;
         
-        // Generate financial report (self-defined format)
-        cout << "=== Financial Report ===\n";
-        cout << "Total Transactions: " << transactions.size() << "\n";
-        
-        double totalIncome = 0.0, totalExpense = 0.0;
-        for (auto& t : transactions) {
-            if (t.isIncome) totalIncome += t.amount;
-            else totalExpense += t.amount;
+        // The rollups are small; copying them under the commit mutex gives a
+        // view consistent with the ledger size read alongside
+        uint64_t total;
+        ArenaVector<FinanceRollup::Bucket> days{ArenaAllocator<FinanceRollup::Bucket>(client.arena)};
+        ArenaVector<FinanceRollup::Bucket> hours{ArenaAllocator<FinanceRollup::Bucket>(client.arena)};
+        int64_t since = time(nullptr) - FinanceRollup::DAY;
+        {
+            lock_guard<mutex> lock(commitMutex);
+            total = transactions.size();
+            financeRollup.forEach(FinanceRollup::DAY, 0, [&](const FinanceRollup::Bucket& bucket) {
+                days.push_back(bucket);
+            });
+            financeRollup.forEach(FinanceRollup::HOUR, since, [&](const FinanceRollup::Bucket& bucket) {
+                hours.push_back(bucket);
+            });
         }
         
-        cout << "Total Income: " << fixed << setprecision(2) << totalIncome << "\n";
-        cout << "Total Expense: " << fixed << setprecision(2) << totalExpense << "\n";
-        cout << "Net Profit: " << fixed << setprecision(2) << (totalIncome - totalExpense) << "\n";
+        // Generate financial report (self-defined format)
+        client.out << "=== Financial Report ===\n";
+        client.out << "Total Transactions: " << total << "\n";
+        
+        Transaction last = ledgerPrefix(total);
+        Money totalIncome = last.totalIncome;
+        Money totalExpense = last.totalExpense;
+        
+        client.out << "Total Income: " << totalIncome << "\n";
+        client.out << "Total Expense: " << totalExpense << "\n";
+        client.out << "Net Profit: " << (totalIncome - totalExpense) << "\n";
+        
+        // Trends come from the rollups: one row per day of the whole ledger,
+        // then one per hour of the last day
+        client.out << "--- Daily ---\n";
+        for (auto& bucket : days) {
+            writeFinanceBucket(client, bucket, "%Y-%m-%d");
+        }
+        client.out << "--- Last 24 Hours ---\n";
+        for (auto& bucket : hours) {
+            writeFinanceBucket(client, bucket, "%Y-%m-%d %H:00");
+        }
         
-        addLog("report finance");
+        addLog(client, LOG_REPORT_FINANCE);
         return true;
     }
     
-    bool cmdReportEmployee(const vector<string>& params) {
+    bool cmdReportEmployee(Client& client, const vector<string_view>& params) {
         if (params.size() != 2) return false;
-        if (getCurrentPrivilege() < 7) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
         if (params[1] != "employee") return false;
         
-        // Generate employee work report (self-defined format)
-        cout << "=== Employee Work Report ===\n";
-        map<string, int> userOps;
-        for (auto& log : logs) {
-            if (!log.userID.empty()) {
-                userOps[log.userID]++;
-            }
+        ArenaVector<pair<UserKey, EmployeeStats>> staff{ArenaAllocator<pair<UserKey, EmployeeStats>>(client.arena)};
+        {
+            lock_guard<mutex> lock(commitMutex);
+            employeeStats.scanAll([&](const UserKey& user, const EmployeeStats& stats) {
+                staff.emplace_back(user, stats);
+                return true;
+            });
         }
         
-        for (auto& p : userOps) {
-            cout << "User: " << p.first << ", Operations: " << p.second << "\n";
+        // Generate employee work report (self-defined format)
+        client.out << "=== Employee Work Report ===\n";
+        for (auto& [user, stats] : staff) {
+            client.out << "User: " << user.view() << ", Operations: " << stats.operations
+                << ", Selects: " << stats.selects
+                << ", Modifies: " << stats.modifies
+                << ", Imports: " << stats.imports
+                << " (" << stats.importedQuantity << " books, " << stats.importCost << ")"
+                << ", Sales: " << stats.sales
+                << " (" << stats.soldQuantity << " books, " << stats.salesIncome << ")\n";
         }
         
-        addLog("report employee");
+        addLog(client, LOG_REPORT_EMPLOYEE);
         return true;
     }
     
-    bool cmdLog(const vector<string>& params) {
-        if (params.size() != 1) return false;
-        if (getCurrentPrivilege() < 7) return false;
+    void writeLogRow(Client& client, const OpRecord& record) {
+        client.out << "[" << record.user.view() << "] " << LOG_OP_NAMES[record.opcode];
+        bool hasTarget = record.target != UserKey();
+        bool hasAmount = record.opcode == LOG_BUY || record.opcode == LOG_IMPORT;
+        if (hasTarget || hasAmount) {
+            client.out << " (" << record.target.view();
+            if (hasAmount) client.out << " " << (long long)record.quantity << " " << record.amount;
+            client.out << ")";
+        }
+        client.out << "\n";
+    }
+    
+    // `log` lists every record in order; `log [UserID]` lists one user's,
+    // newest first, through their chain in the operation log
+    bool cmdLog(Client& client, const vector<string_view>& params) {
+        if (params.size() > 2) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
+        if (params.size() == 2 && !isValidUserID(params[1])) return false;
         
         // Generate log (self-defined format)
-        cout << "=== System Log ===\n";
-        for (auto& log : logs) {
-            cout << "[" << log.userID << "] " << log.operation;
-            if (!log.details.empty()) {
-                cout << " (" << log.details << ")";
+        SnapshotGuard snapshot(snapshots);
+        if (params.size() == 2) {
+            UserKey user(params[1]);
+            uint64_t last;
+            {
+                // The leader updates the chain heads as it commits
+                lock_guard<mutex> lock(commitMutex);
+                last = opLog.lastOf(user);
             }
-            cout << "\n";
+            client.out << "=== Log of " << params[1] << " ===\n";
+            opLog.forEachByUser(last, snapshot->logSize, [&](uint64_t, const OpRecord& record) {
+                writeLogRow(client, record);
+            });
+        } else {
+            client.out << "=== System Log ===\n";
+            opLog.forEach(0, snapshot->logSize, [&](uint64_t, const OpRecord& record) {
+                writeLogRow(client, record);
+            });
         }
         
-        addLog("log");
+        addLog(client, LOG_LOG);
+        return true;
+    }
+    
+    // Per-command counts and latencies since startup, and buffer pool I/O;
+    // not logged, and Invalid in builds without BOOKSTORE_STATS
+    bool cmdStats(Client& client, const vector<string_view>& params) {
+        if (!commandStats.ENABLED) return false;
+        if (params.size() != 1) return false;
+        if (getCurrentPrivilege(client) < 7) return false;
+        
+        client.out << statsReport();
         return true;
     }
     
     // ==================== Command Processor ====================
     
-    void saveAll() {
-        saveAccounts();
-        saveBooks();
-        saveTransactions();
+    // Replies leave only once the commits they acknowledge, and any they
+    // may have read, are durable
+    void openClient(Client& client) {
+        client.out.setBeforeWrite([this, &client] { wal.waitDurable(client.ackPosition); });
     }
     
-    void processCommand(const string& line) {
-        string trimmed = trim(line);
-        if (trimmed.empty()) return;
+    // Sessions still open when a client goes away no longer keep their
+    // users from being deleted
+    void closeClient(Client& client) {
+        for (const LoginSession& session : client.loginStack) {
+            countLogin(session.userID, -1);
+        }
+        client.loginStack.clear();
+    }
+    
+    // Runs one command line for `client`; returns false on quit/exit
+    bool processCommand(Client& client, const string& line) {
+        vector<string_view>& params = client.params;
+        tokenize(line, params);
+        if (params.empty()) return true;
         
-        vector<string> params = split(trimmed);
-        if (params.empty()) return;
+        uint64_t started = commandStats.now();
+        CommandId command = lookupCommand(params[0]);
+        if (command == CMD_QUIT || command == CMD_EXIT) return false;
         
-        string cmd = params[0];
         bool success = false;
+        bool done = false;
+        if (readsSnapshot(command)) {
+            // Reads take the storage lock themselves, a chunk at a time
+            success = dispatch(client, command);
+            shared_lock<shared_mutex> lock(storageMutex);
+            finishCommand(client);
+            done = true;
+        }
+        if (!done) {
+            shared_lock<shared_mutex> lock(storageMutex);
+            if (runsShared(client, command)) {
+                success = dispatch(client, command);
+                finishCommand(client);
+                done = true;
+            }
+        }
+        if (!done) {
+            unique_lock<shared_mutex> lock(storageMutex);
+            success = dispatch(client, command);
+            finishCommand(client);
+        }
+        if (checkpointDue) {
+            unique_lock<shared_mutex> lock(storageMutex);
+            if (checkpointDue.exchange(false)) {
+                if (wal.inBatch()) relieveBatch();
+                else checkpoint();
+            }
+        }
         
-        if (cmd == "quit" || cmd == "exit") {
-            saveAll();
-            exit(0);
-        } else if (cmd == "su") {
-            success = cmdSu(params);
-        } else if (cmd == "logout") {
-            success = cmdLogout(params);
-        } else if (cmd == "register") {
-            success = cmdRegister(params);
-        } else if (cmd == "passwd") {
-            success = cmdPasswd(params);
-        } else if (cmd == "useradd") {
-            success = cmdUseradd(params);
-        } else if (cmd == "delete") {
-            success = cmdDelete(params);
-        } else if (cmd == "show") {
+        if (!success) {
+            client.out << "Invalid\n";
+        }
+        client.arena.reset();
+        commandStats.record(command, commandStats.now() - started, success);
+        return true;
+    }
+    
+    // What `stats` prints, and what --metrics writes out
+    string statsReport() {
+        string report;
+        commandStats.format(report, COMMAND_NAMES);
+        BufferPool::Stats io = pool.statistics();
+        report += "pages: " + to_string(io.hits) + " hits, " + to_string(io.misses) + " reads, "
+                + to_string(io.writes) + " writes, " + to_string(io.evictions) + " evictions\n";
+        report += string("scan: ") + scanKernelName() + "\n";
+        return report;
+    }
+    
+private:
+    // Commands that read a snapshot instead of holding the storage lock;
+    // stats reads no stored data at all
+    static bool readsSnapshot(CommandId command) {
+        return command == CMD_SHOW || command == CMD_REPORT || command == CMD_LOG || command == CMD_STATS;
+    }
+    
+    // Whether a command can run under the shared storage lock: it only
+    // reads the store, or it only changes the stock of an existing book
+    bool runsShared(const Client& client, CommandId command) {
+        switch (command) {
+        case CMD_SU:
+        case CMD_LOGOUT:
+        case CMD_BUY:
+            return true;
+        case CMD_SELECT:
+            // Selecting an unknown ISBN creates the book
+            return client.params.size() == 2 && books.contains(client.params[1]);
+        case CMD_IMPORT: {
+            // Importing into a book renamed away recreates it
+            ISBNKey isbn = getSelectedISBN(client);
+            return isbn.empty() || books.contains(isbn);
+        }
+        default:
+            return false;
+        }
+    }
+    
+    bool dispatch(Client& client, CommandId command) {
+        const vector<string_view>& params = client.params;
+        switch (command) {
+        case CMD_SU:
+            return cmdSu(client, params);
+        case CMD_LOGOUT:
+            return cmdLogout(client, params);
+        case CMD_REGISTER:
+            return cmdRegister(client, params);
+        case CMD_PASSWD:
+            return cmdPasswd(client, params);
+        case CMD_USERADD:
+            return cmdUseradd(client, params);
+        case CMD_DELETE:
+            return cmdDelete(client, params);
+        case CMD_SHOW:
             if (params.size() >= 2 && params[1] == "finance") {
-                success = cmdShowFinance(params);
-            } else {
-                success = cmdShow(params);
+                return cmdShowFinance(client, params);
             }
-        } else if (cmd == "buy") {
-            success = cmdBuy(params);
-        } else if (cmd == "select") {
-            success = cmdSelect(params);
-        } else if (cmd == "modify") {
-            success = cmdModify(params);
-        } else if (cmd == "import") {
-            success = cmdImport(params);
-        } else if (cmd == "report") {
+            return cmdShow(client, params);
+        case CMD_BUY:
+            return cmdBuy(client, params);
+        case CMD_SELECT:
+            return cmdSelect(client, params);
+        case CMD_MODIFY:
+            return cmdModify(client, params);
+        case CMD_IMPORT:
+            return cmdImport(client, params);
+        case CMD_REPORT:
             if (params.size() >= 2 && params[1] == "finance") {
-                success = cmdReportFinance(params);
-            } else if (params.size() >= 2 && params[1] == "employee") {
-                success = cmdReportEmployee(params);
-            } else {
-                success = false;
+                return cmdReportFinance(client, params);
             }
-        } else if (cmd == "log") {
-            success = cmdLog(params);
-        } else {
-            success = false;
+            if (params.size() >= 2 && params[1] == "employee") {
+                return cmdReportEmployee(client, params);
+            }
+            return false;
+        case CMD_LOG:
+            return cmdLog(client, params);
+        case CMD_STATS:
+            return cmdStats(client, params);
+        default:
+            return false;
+        }
+    }
+    
+    // ==================== Commit Queue ====================
+    
+    // Pushes the command onto the commit queue with a CAS, then waits for
+    // the commit mutex. Whoever gets it first commits every queued command,
+    // so the others usually find their own work already done.
+    void finishCommand(Client& client) {
+        client.committed = false;
+        client.nextCommit = commitQueue.load(memory_order_relaxed);
+        while (!commitQueue.compare_exchange_weak(client.nextCommit, &client,
+                                                  memory_order_release, memory_order_relaxed)) {
+        }
+        {
+            lock_guard<mutex> lock(commitMutex);
+            if (!client.committed) commitQueued();
+        }
+        if (client.bookLatch.owns_lock()) client.bookLatch.unlock();
+    }
+    
+    void commitQueued() {
+        // The queue is a stack; reverse it to commit in arrival order
+        Client* ordered = nullptr;
+        Client* next = commitQueue.exchange(nullptr, memory_order_acquire);
+        while (next) {
+            Client* c = next;
+            next = c->nextCommit;
+            c->nextCommit = ordered;
+            ordered = c;
+        }
+        for (Client* c = ordered; c; c = c->nextCommit) {
+            commitClient(*c);
         }
+        uint64_t horizon = snapshots.horizon();
+        stockVersions.collect(horizon);
+        textVersions.collect(horizon);
         
-        if (!success) {
-            cout << "Invalid\n";
+        if (checkpointNeeded()) checkpointDue = true;
+    }
+    
+    // Logs the command's applied mutations, then appends its ledger and
+    // operation log entries, and ends it in the WAL
+    void commitClient(Client& client) {
+        for (auto& r : client.pendingRedo) {
+            wal.logRedo(&r, sizeof(r));
+        }
+        for (auto& r : client.pendingLedger) {
+            execute(r);
+        }
+        for (auto& entry : client.pendingLog) {
+            appendLog(entry);
         }
+        client.pendingRedo.clear();
+        client.pendingLedger.clear();
+        client.pendingLog.clear();
+        wal.commit();
+        client.ackPosition = wal.written();
+        
+        commitSeq++;
+        for (auto& touched : client.touchedBooks) {
+            stockVersions.stamp(touched.isbn, commitSeq);
+            if (touched.text) textVersions.stamp(touched.isbn, commitSeq);
+        }
+        client.touchedBooks.clear();
+        publishSnapshot();
+        client.committed = true;
+    }
+    
+    void publishSnapshot() {
+        Snapshot snapshot;
+        snapshot.seq = commitSeq;
+        snapshot.ledgerSize = transactions.size();
+        snapshot.logSize = opLog.size();
+        snapshots.publish(snapshot);
+    }
+};
+
+// Connects the socket server to the bookstore: one Client per connection
+struct ClientHandler {
+    typedef Client Session;
+    
+    BookstoreSystem& system;
+    
+    Client* open(int fd) {
+        Client* client = new Client(fd);
+        system.openClient(*client);
+        return client;
+    }
+    
+    bool handleLine(Client& client, const string& line) {
+        return system.processCommand(client, line);
+    }
+    
+    void flush(Client& client) {
+        client.out.flush();
+    }
+    
+    void close(Client* client) {
+        system.closeClient(*client);
+        delete client;
     }
 };
 
-int main() {
+int serve(BookstoreSystem& system, const string& address) {
+    ClientHandler handler{system};
+    SocketServer<ClientHandler> server(handler);
+    if (!server.listenOn(address)) return 1;
+    server.run(max(1u, thread::hardware_concurrency()));
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
     
+    // --listen ADDRESS serves clients over a socket instead of stdin
+    // --batch runs the whole input as one atomic batch
+    // --metrics PATH rewrites PATH with the stats every --metrics-interval
+    // seconds (10 by default) and at exit
+    string listenAddress;
+    bool batch = false;
+    string metricsPath;
+    unsigned metricsInterval = 10;
+    for (int i = 1; i < argc; i++) {
+        string_view arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--listen" && hasValue) {
+            listenAddress = argv[++i];
+        } else if (arg == "--batch") {
+            batch = true;
+        } else if (arg == "--metrics" && hasValue && BOOKSTORE_STATS) {
+            metricsPath = argv[++i];
+        } else if (arg == "--metrics-interval" && hasValue && atoi(argv[i + 1]) > 0) {
+            metricsInterval = atoi(argv[++i]);
+        } else {
+            cerr << "usage: code [--listen unix:PATH|PORT] [--batch] [--metrics PATH [--metrics-interval SECONDS]]\n";
+            return 2;
+        }
+    }
+    
     BookstoreSystem system;
+    unique_ptr<MetricsWriter> metrics;
+    if (!metricsPath.empty()) {
+        metrics.reset(new MetricsWriter(metricsPath, metricsInterval, [&system] { return system.statsReport(); }));
+    }
+    
+    if (!listenAddress.empty()) {
+        return serve(system, listenAddress);
+    }
+    
+    if (batch) {
+        system.beginBatch();
+    }
     
+    Client console(STDOUT_FILENO);
+    system.openClient(console);
     string line;
     while (getline(cin, line)) {
-        system.processCommand(line);
+        if (!system.processCommand(console, line)) break;
+        // Replies wait while more input is buffered, so that piped input
+        // shares fdatasyncs
+        if (cin.rdbuf()->in_avail() <= 0) console.out.flush();
     }
+    system.closeClient(console);
     
     return 0;
 }
@@ -0,0 +1,83 @@
+#ifndef BOOKSTORE_MONEY_H
+#define BOOKSTORE_MONEY_H
+
+#include <string_view>
+
+// ==================== Money ====================
+
+// Fixed-point amount stored as a whole number of cents. All arithmetic is
+// exact integer math; the representable range is about +/-9.2e16.
+struct Money {
+    long long cents;
+
+    Money() : cents(0) {}
+    explicit Money(long long c) : cents(c) {}
+
+    // Parses digits with at most one '.'; digits past the second decimal
+    // place round half up. Returns false on any other character.
+    static bool parse(std::string_view s, Money& out) {
+        long long whole = 0, frac = 0;
+        int fracDigits = 0;
+        bool seenDot = false, roundUp = false;
+        for (char c : s) {
+            if (c == '.') {
+                if (seenDot) return false;
+                seenDot = true;
+            } else if (c >= '0' && c <= '9') {
+                if (!seenDot) {
+                    whole = whole * 10 + (c - '0');
+                } else if (fracDigits < 2) {
+                    frac = frac * 10 + (c - '0');
+                    fracDigits++;
+                } else if (fracDigits == 2) {
+                    roundUp = c >= '5';
+                    fracDigits++;
+                }
+            } else {
+                return false;
+            }
+        }
+        while (fracDigits < 2) {
+            frac *= 10;
+            fracDigits++;
+        }
+        out.cents = whole * 100 + frac + (roundUp ? 1 : 0);
+        return true;
+    }
+
+    // Exact two-decimal rendering, e.g. "-12.05", written right-aligned
+    // into `digits`; returns a view of the text
+    std::string_view format(char (&digits)[32]) const {
+        unsigned long long v = cents < 0 ? -(unsigned long long)cents : cents;
+        char* end = digits + sizeof(digits);
+        char* start = end;
+        *--start = '0' + v % 10;
+        *--start = '0' + v / 10 % 10;
+        *--start = '.';
+        v /= 100;
+        do {
+            *--start = '0' + v % 10;
+            v /= 10;
+        } while (v > 0);
+        if (cents < 0) *--start = '-';
+        return std::string_view(start, end - start);
+    }
+
+    Money operator+(const Money& other) const { return Money(cents + other.cents); }
+    Money operator-(const Money& other) const { return Money(cents - other.cents); }
+    Money& operator+=(const Money& other) { cents += other.cents; return *this; }
+    Money& operator-=(const Money& other) { cents -= other.cents; return *this; }
+
+    // Checked arithmetic; false if the result does not fit
+    bool times(long long factor, Money& out) const {
+        return !__builtin_mul_overflow(cents, factor, &out.cents);
+    }
+    bool plus(const Money& other, Money& out) const {
+        return !__builtin_add_overflow(cents, other.cents, &out.cents);
+    }
+
+    bool operator<(const Money& other) const { return cents < other.cents; }
+    bool operator==(const Money& other) const { return cents == other.cents; }
+};
+
+#endif
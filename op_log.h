@@ -0,0 +1,98 @@
+#ifndef BOOKSTORE_OP_LOG_H
+#define BOOKSTORE_OP_LOG_H
+
+#include <string>
+#include <cstdint>
+#include "fixed_string.h"
+#include "money.h"
+#include "buffer_pool.h"
+#include "bplus_tree.h"
+#include "record_file.h"
+
+// ==================== Operation Log ====================
+
+// One logged command. `target` is the ISBN or user ID the command acted on.
+struct OpRecord {
+    int64_t timestamp;        // seconds since the epoch
+    uint64_t prevByUser;      // 1 + number of the user's previous record, 0 if none
+    FixedString<31> user;     // empty when nobody was logged in
+    FixedString<31> target;
+    uint8_t opcode;
+    int64_t quantity;
+    Money amount;
+
+    OpRecord() : timestamp(0), prevByUser(0), opcode(0), quantity(0) {}
+};
+
+// Append-only file of fixed-width operation records. Record i sits at a
+// computed position of the record file, so any record number is one page
+// access away. Each user's records are chained newest to oldest, and a
+// B+ tree maps every user to the head of their chain.
+class OperationLog {
+public:
+    typedef FixedString<31> UserKey;
+
+private:
+    RecordFile<OpRecord> records;
+    BPlusTree<UserKey, uint64_t> lastByUser; // 1 + number of the newest record
+
+public:
+    OperationLog(BufferPool& pool, const std::string& path, const std::string& userIndexPath)
+        : records(pool, path), lastByUser(pool, userIndexPath) {}
+
+    uint64_t size() const {
+        return records.size();
+    }
+
+    void get(uint64_t index, OpRecord& record) {
+        records.get(index, record);
+    }
+
+    void append(OpRecord record) {
+        uint64_t index = records.size();
+        record.prevByUser = 0;
+        if (record.user != UserKey()) {
+            uint64_t last;
+            if (lastByUser.find(record.user, last)) {
+                record.prevByUser = last;
+                lastByUser.update(record.user, index + 1);
+            } else {
+                lastByUser.insert(record.user, index + 1);
+            }
+        }
+        records.append(record);
+    }
+
+    // Calls visit(index, record) for records from..to-1 in order
+    template <class Visitor>
+    void forEach(uint64_t from, uint64_t to, Visitor visit) {
+        OpRecord record;
+        for (uint64_t i = from; i < to; i++) {
+            records.get(i, record);
+            visit(i, record);
+        }
+    }
+
+    // 1 + number of the newest record of `user`, 0 if none; where
+    // forEachByUser starts
+    uint64_t lastOf(const UserKey& user) {
+        uint64_t last = 0;
+        lastByUser.find(user, last);
+        return last;
+    }
+
+    // Calls visit(index, record) for a user's records below `to`, newest
+    // first, following their chain from `last`. Records never change once
+    // appended, so this may run while others are appended.
+    template <class Visitor>
+    void forEachByUser(uint64_t last, uint64_t to, Visitor visit) {
+        OpRecord record;
+        while (last != 0) {
+            records.get(last - 1, record);
+            if (last - 1 < to) visit(last - 1, record);
+            last = record.prevByUser;
+        }
+    }
+};
+
+#endif
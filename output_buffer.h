@@ -0,0 +1,182 @@
+#ifndef BOOKSTORE_OUTPUT_BUFFER_H
+#define BOOKSTORE_OUTPUT_BUFFER_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "money.h"
+
+// ==================== Output Buffer ====================
+
+// Output sink with one reusable buffer in front of a file descriptor.
+// Numbers are formatted by hand straight into the buffer, and the buffer
+// is written out when it fills up or when the owner calls flush(). An
+// optional hook runs before any of it reaches the descriptor, e.g. to make
+// what the output acknowledges durable first.
+class OutputBuffer {
+private:
+    static const size_t CAPACITY = 1 << 16;
+    static const size_t MAX_FRAGMENTS = 16;
+
+    int fd;
+    size_t length;
+    std::function<void()> beforeWrite;
+    char buffer[CAPACITY];
+
+    static void writeAll(int fd, const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n <= 0) return;
+            data += n;
+            size -= n;
+        }
+    }
+
+    // Makes room for `size` more bytes, which must not exceed CAPACITY
+    void reserve(size_t size) {
+        if (length + size > CAPACITY) flush();
+    }
+
+    // Writes the digits of v right-aligned ending at `end`; returns the start
+    static char* formatDigits(unsigned long long v, char* end) {
+        do {
+            *--end = '0' + v % 10;
+            v /= 10;
+        } while (v > 0);
+        return end;
+    }
+
+    void prepareWrite() {
+        if (beforeWrite) beforeWrite();
+    }
+
+public:
+    explicit OutputBuffer(int fileDescriptor) : fd(fileDescriptor), length(0) {}
+
+    ~OutputBuffer() {
+        flush();
+    }
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    void setBeforeWrite(std::function<void()> hook) {
+        beforeWrite = hook;
+    }
+
+    void flush() {
+        if (length == 0) return;
+        prepareWrite();
+        writeAll(fd, buffer, length);
+        length = 0;
+    }
+
+    void write(std::string_view s) {
+        if (s.size() > CAPACITY) {
+            flush();
+            prepareWrite();
+            writeAll(fd, s.data(), s.size());
+            return;
+        }
+        reserve(s.size());
+        memcpy(buffer + length, s.data(), s.size());
+        length += s.size();
+    }
+
+    void put(char c) {
+        reserve(1);
+        buffer[length++] = c;
+    }
+
+    // Formats v into `digits` and returns a view of the text
+    static std::string_view formatInt(long long v, char (&digits)[24]) {
+        char* end = digits + sizeof(digits);
+        char* start = formatDigits(v < 0 ? -(unsigned long long)v : v, end);
+        if (v < 0) *--start = '-';
+        return std::string_view(start, end - start);
+    }
+
+    void writeInt(long long v) {
+        char digits[24];
+        write(formatInt(v, digits));
+    }
+
+    void writeMoney(const Money& money) {
+        char digits[32];
+        write(money.format(digits));
+    }
+
+    // Appends several fragments as one unit. When they do not fit, the
+    // pending buffer and the fragments go out together in one writev.
+    void writeFragments(const std::string_view* parts, size_t count) {
+        size_t total = 0;
+        for (size_t i = 0; i < count; i++) total += parts[i].size();
+        if (length + total <= CAPACITY || count >= MAX_FRAGMENTS) {
+            for (size_t i = 0; i < count; i++) write(parts[i]);
+            return;
+        }
+
+        iovec iov[MAX_FRAGMENTS];
+        iov[0].iov_base = buffer;
+        iov[0].iov_len = length;
+        for (size_t i = 0; i < count; i++) {
+            iov[i + 1].iov_base = const_cast<char*>(parts[i].data());
+            iov[i + 1].iov_len = parts[i].size();
+        }
+        prepareWrite();
+        ssize_t n = ::writev(fd, iov, count + 1);
+        if (n < 0) n = 0;
+        length = 0;
+        // Finish any part the kernel did not take
+        for (size_t i = 0; i <= count; i++) {
+            size_t size = iov[i].iov_len;
+            if ((size_t)n >= size) {
+                n -= size;
+                continue;
+            }
+            writeAll(fd, (const char*)iov[i].iov_base + n, size - n);
+            n = 0;
+        }
+    }
+
+    OutputBuffer& operator<<(std::string_view s) {
+        write(s);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const char* s) {
+        write(std::string_view(s));
+        return *this;
+    }
+
+    OutputBuffer& operator<<(char c) {
+        put(c);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(int v) {
+        writeInt(v);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(long long v) {
+        writeInt(v);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(unsigned long v) {
+        writeInt((long long)v);
+        return *this;
+    }
+
+    OutputBuffer& operator<<(const Money& money) {
+        writeMoney(money);
+        return *this;
+    }
+};
+
+#endif
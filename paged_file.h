@@ -0,0 +1,175 @@
+#ifndef BOOKSTORE_PAGED_FILE_H
+#define BOOKSTORE_PAGED_FILE_H
+
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// ==================== Paged File ====================
+
+const size_t PAGE_SIZE = 4096;
+
+// On-disk format version shared by every data file. Bump it whenever the
+// layout of any file changes.
+const uint32_t FORMAT_VERSION = 6;
+
+// Every data file starts with its structure's magic number and the format
+// version, followed by the structure's own header fields.
+struct FormatHeader {
+    uint32_t magic;
+    uint32_t version;
+};
+
+// Returns false for a fresh file whose header still has to be written. A
+// file of another structure or format version is never overwritten: the
+// process stops instead.
+inline bool checkFormat(const void* page, uint32_t magic, const std::string& path) {
+    FormatHeader header;
+    memcpy(&header, page, sizeof(header));
+    if (header.magic == 0 && header.version == 0) return false;
+    if (header.magic != magic || header.version != FORMAT_VERSION) {
+        fprintf(stderr, "%s: unsupported data file format\n", path.c_str());
+        exit(1);
+    }
+    return true;
+}
+
+// A data file viewed as an array of fixed-size pages. The file is mapped
+// into memory on first access and pages are copied in and out of the
+// mapping individually, so no operation touches more of the file than it
+// asks for. The mapping only grows; after MAPPED_PAGE_BUDGET page
+// accesses its pages are dropped from the process again, which keeps the
+// resident set bounded no matter how large the file is.
+class PagedFile {
+private:
+    static constexpr size_t MIN_MAP_BYTES = 64 * PAGE_SIZE;
+    static const uint32_t MAPPED_PAGE_BUDGET = 256;
+
+    std::string filePath;
+    int fd;
+    uint32_t id;
+    uint32_t pages;
+    uint64_t fileBytes;
+    char* map;
+    size_t mapBytes;
+    uint32_t touched;
+    bool unsynced;
+
+    // Makes the first `bytes` bytes of the file addressable
+    void ensureMapped(size_t bytes) {
+        if (bytes <= mapBytes) return;
+        size_t capacity = std::max(std::max(bytes, 2 * mapBytes), MIN_MAP_BYTES);
+        void* addr = map == nullptr
+            ? mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : mremap(map, mapBytes, capacity, MREMAP_MAYMOVE);
+        if (addr == MAP_FAILED) {
+            fprintf(stderr, "%s: cannot map file\n", filePath.c_str());
+            exit(1);
+        }
+        map = (char*)addr;
+        mapBytes = capacity;
+    }
+
+    void touch() {
+        if (++touched >= MAPPED_PAGE_BUDGET) {
+            // Shared file pages stay in the page cache, dirty or not
+            madvise(map, mapBytes, MADV_DONTNEED);
+            touched = 0;
+        }
+    }
+
+    static uint32_t nextId() {
+        static uint32_t counter = 0;
+        return counter++;
+    }
+
+public:
+    explicit PagedFile(const std::string& path)
+        : filePath(path), id(nextId()), map(nullptr), mapBytes(0), touched(0), unsynced(false) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        struct stat st;
+        fstat(fd, &st);
+        fileBytes = st.st_size;
+        pages = st.st_size / PAGE_SIZE;
+    }
+
+    ~PagedFile() {
+        if (map != nullptr) munmap(map, mapBytes);
+        close(fd);
+    }
+
+    PagedFile(const PagedFile&) = delete;
+    PagedFile& operator=(const PagedFile&) = delete;
+
+    // Process-unique id, used to tell files apart in the buffer pool
+    uint32_t fileId() const {
+        return id;
+    }
+
+    const std::string& path() const {
+        return filePath;
+    }
+
+    uint32_t pageCount() const {
+        return pages;
+    }
+
+    // Bytes in the file itself; pages allocated since may lie beyond
+    uint64_t size() const {
+        return fileBytes;
+    }
+
+    void read(uint32_t pageId, void* buf) {
+        uint64_t offset = (uint64_t)pageId * PAGE_SIZE;
+        // Pages past the end of the file read as zeros
+        size_t n = offset < fileBytes ? std::min<uint64_t>(PAGE_SIZE, fileBytes - offset) : 0;
+        if (n > 0) {
+            ensureMapped(fileBytes);
+            memcpy(buf, map + offset, n);
+            touch();
+        }
+        memset((char*)buf + n, 0, PAGE_SIZE - n);
+    }
+
+    void write(uint32_t pageId, const void* buf) {
+        uint64_t end = ((uint64_t)pageId + 1) * PAGE_SIZE;
+        if (end > fileBytes) {
+            ftruncate(fd, end);
+            fileBytes = end;
+        }
+        ensureMapped(fileBytes);
+        memcpy(map + end - PAGE_SIZE, buf, PAGE_SIZE);
+        touch();
+        unsynced = true;
+        if (pageId >= pages) pages = pageId + 1;
+    }
+
+    void sync() {
+        if (!unsynced) return;
+        msync(map, fileBytes, MS_SYNC);
+        unsynced = false;
+    }
+
+    // Reserves the next page id. The page reads as zeros until it is first
+    // written back.
+    uint32_t allocate() {
+        return pages++;
+    }
+
+    // Drops every page from `count` on; the mapping keeps its size
+    void truncate(uint32_t count) {
+        if (count >= pages) return;
+        pages = count;
+        fileBytes = std::min<uint64_t>(fileBytes, (uint64_t)count * PAGE_SIZE);
+        ftruncate(fd, fileBytes);
+    }
+};
+
+#endif
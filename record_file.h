@@ -0,0 +1,82 @@
+#ifndef BOOKSTORE_RECORD_FILE_H
+#define BOOKSTORE_RECORD_FILE_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "buffer_pool.h"
+
+// ==================== Record File ====================
+
+// Append-only array of fixed-size records stored in pages behind the
+// buffer pool. Page 0 holds the header; record i lives in page
+// 1 + i / PER_PAGE, so any record is one page access away.
+template <class T>
+class RecordFile {
+private:
+    static const uint32_t MAGIC = 0x31434552; // "REC1"
+    static constexpr uint32_t PER_PAGE = PAGE_SIZE / sizeof(T);
+
+    static_assert(PER_PAGE >= 1, "record does not fit in a page");
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t count;
+    };
+
+    BufferPool& pool;
+    PagedFile file;
+    Header header;
+
+    void writeHeader() {
+        PageGuard page = pool.fetch(file, 0);
+        memcpy(page.data(), &header, sizeof(header));
+        page.markDirty();
+    }
+
+public:
+    RecordFile(BufferPool& bufferPool, const std::string& path) : pool(bufferPool), file(path) {
+        if (file.pageCount() == 0) {
+            pool.allocate(file);
+        }
+        memcpy(&header, pool.fetch(file, 0).data(), sizeof(header));
+        if (!checkFormat(&header, MAGIC, path)) {
+            header.magic = MAGIC;
+            header.version = FORMAT_VERSION;
+            header.count = 0;
+            writeHeader();
+        }
+    }
+
+    uint64_t size() const {
+        return header.count;
+    }
+
+    void get(uint64_t index, T& record) {
+        PageGuard page = pool.fetch(file, 1 + index / PER_PAGE);
+        memcpy(&record, page.data() + (index % PER_PAGE) * sizeof(T), sizeof(T));
+    }
+
+    void set(uint64_t index, const T& record) {
+        PageGuard page = pool.fetch(file, 1 + index / PER_PAGE);
+        memcpy(page.data() + (index % PER_PAGE) * sizeof(T), &record, sizeof(T));
+        page.markDirty();
+    }
+
+    void append(const T& record) {
+        uint64_t index = header.count;
+        if (index % PER_PAGE == 0) {
+            // First record of a fresh page
+            PageGuard page = pool.allocate(file);
+            memcpy(page.data(), &record, sizeof(T));
+        } else {
+            set(index, record);
+        }
+        header.count++;
+        writeHeader();
+    }
+};
+
+#endif
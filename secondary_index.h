@@ -0,0 +1,112 @@
+#ifndef BOOKSTORE_SECONDARY_INDEX_H
+#define BOOKSTORE_SECONDARY_INDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "fixed_string.h"
+#include "bplus_tree.h"
+
+// ==================== Secondary Index ====================
+
+// Persistent multimap from a book field (name, author or one keyword
+// segment) to ISBN. Entries are stored as (field, ISBN) composite keys of
+// a B+ tree, so all ISBNs for one field value are adjacent and already in
+// ascending ISBN order.
+//
+// While updates are deferred, add and remove are queued and applied in key
+// order when the deferral ends or the index is next read, so a long batch
+// of updates walks the tree front to back once.
+class SecondaryIndex {
+public:
+    typedef FixedString<61> FieldKey;
+    typedef FixedString<21> ISBNKey;
+
+private:
+    struct Entry {
+        FieldKey field;
+        ISBNKey isbn;
+
+        Entry() {}
+        Entry(const FieldKey& f, const ISBNKey& i) : field(f), isbn(i) {}
+
+        bool operator<(const Entry& other) const {
+            if (field != other.field) return field < other.field;
+            return isbn < other.isbn;
+        }
+
+        bool operator==(const Entry& other) const {
+            return field == other.field && isbn == other.isbn;
+        }
+    };
+
+    struct PendingUpdate {
+        Entry entry;
+        bool add;
+    };
+
+    BPlusTree<Entry, char> tree;
+    bool deferring;
+    std::vector<PendingUpdate> pending;
+
+    // Updates of the same entry keep their relative order
+    void applyPending() {
+        std::stable_sort(pending.begin(), pending.end(),
+                         [](const PendingUpdate& a, const PendingUpdate& b) { return a.entry < b.entry; });
+        for (auto& update : pending) {
+            if (update.add) tree.insert(update.entry, 0);
+            else tree.erase(update.entry);
+        }
+        pending.clear();
+    }
+
+public:
+    SecondaryIndex(BufferPool& pool, const std::string& path) : tree(pool, path), deferring(false) {}
+
+    void deferUpdates(bool defer) {
+        if (!defer) applyPending();
+        deferring = defer;
+    }
+
+    // Updates queued while deferred; applying one dirties about one page
+    size_t pendingUpdates() const {
+        return pending.size();
+    }
+
+    // Applies the queued updates now and stays deferred
+    void applyDeferred() {
+        if (!pending.empty()) applyPending();
+    }
+
+    void add(const FieldKey& field, const ISBNKey& isbn) {
+        if (deferring) pending.push_back({Entry(field, isbn), true});
+        else tree.insert(Entry(field, isbn), 0);
+    }
+
+    void remove(const FieldKey& field, const ISBNKey& isbn) {
+        if (deferring) pending.push_back({Entry(field, isbn), false});
+        else tree.erase(Entry(field, isbn));
+    }
+
+    // Calls visit(isbn) for every book indexed under `field`, in ISBN order
+    template <class Visitor>
+    void forEach(const FieldKey& field, Visitor visit) {
+        if (!pending.empty()) applyPending();
+        tree.scan(Entry(field, ISBNKey()), [&](const Entry& entry, const char&) {
+            if (entry.field != field) return false;
+            visit(entry.isbn);
+            return true;
+        });
+    }
+
+    // See BPlusTree; the index is left alone while updates are deferred
+    bool compactStep() {
+        return !deferring && tree.compactStep();
+    }
+
+    bool trimFreeTail() {
+        return tree.trimFreeTail();
+    }
+};
+
+#endif
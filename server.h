@@ -0,0 +1,233 @@
+#ifndef BOOKSTORE_SERVER_H
+#define BOOKSTORE_SERVER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <unordered_set>
+#include <csignal>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// ==================== Socket Server ====================
+
+// Set by SIGINT/SIGTERM; the workers finish their current line and stop
+inline volatile sig_atomic_t serverStopRequested = 0;
+
+inline void requestServerStop(int) {
+    serverStopRequested = 1;
+}
+
+// Line-oriented server for many local connections. A pool of worker
+// threads waits on one epoll set; every connection is armed one-shot, so
+// at most one worker handles a given connection at a time and its lines
+// run in order. The handler supplies the per-connection state:
+//
+//     typedef ... Session;
+//     Session* open(int fd);
+//     bool handleLine(Session& session, const std::string& line); // false closes
+//     void flush(Session& session); // after the lines of each read
+//     void close(Session* session);
+template <class Handler>
+class SocketServer {
+private:
+    static const int MAX_EVENTS = 16;
+    static const int POLL_TIMEOUT_MS = 200; // how often idle workers check for stop
+    static const size_t READ_CHUNK = 1 << 14;
+
+    struct Connection {
+        int fd;
+        std::string input; // bytes received but not yet a complete line
+        typename Handler::Session* session;
+    };
+
+    Handler& handler;
+    int listenFd;
+    int epollFd;
+    std::mutex connectionsMutex;
+    std::unordered_set<Connection*> connections;
+
+    void rearm(int fd, void* ptr) {
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = ptr;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void acceptAll() {
+        while (true) {
+            // Connections stay blocking for replies; reads use MSG_DONTWAIT
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) break;
+            Connection* conn = new Connection{fd, std::string(), handler.open(fd)};
+            {
+                std::lock_guard<std::mutex> lock(connectionsMutex);
+                connections.insert(conn);
+            }
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLONESHOT;
+            ev.data.ptr = conn;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        rearm(listenFd, nullptr);
+    }
+
+    void closeConnection(Connection* conn) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        {
+            std::lock_guard<std::mutex> lock(connectionsMutex);
+            connections.erase(conn);
+        }
+        handler.close(conn->session);
+        ::close(conn->fd);
+        delete conn;
+    }
+
+    // Reads what is available and runs every complete line; returns false
+    // once the connection should close
+    bool serve(Connection* conn) {
+        char chunk[READ_CHUNK];
+        bool open = true;
+        while (true) {
+            ssize_t n = recv(conn->fd, chunk, sizeof(chunk), MSG_DONTWAIT);
+            if (n > 0) {
+                conn->input.append(chunk, n);
+                if ((size_t)n < sizeof(chunk)) break;
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) open = false;
+            if (n < 0 && errno == EINTR) continue;
+            break;
+        }
+
+        size_t start = 0;
+        std::string line;
+        while (true) {
+            size_t end = conn->input.find('\n', start);
+            if (end == std::string::npos) break;
+            line.assign(conn->input, start, end - start);
+            start = end + 1;
+            if (!handler.handleLine(*conn->session, line)) return false;
+            if (serverStopRequested) break;
+        }
+        conn->input.erase(0, start);
+        // A last line without a newline still runs when the peer hangs up
+        if (!open && !conn->input.empty()) {
+            handler.handleLine(*conn->session, conn->input);
+        }
+        handler.flush(*conn->session);
+        return open;
+    }
+
+    void work() {
+        epoll_event events[MAX_EVENTS];
+        while (!serverStopRequested) {
+            int n = epoll_wait(epollFd, events, MAX_EVENTS, POLL_TIMEOUT_MS);
+            for (int i = 0; i < n; i++) {
+                Connection* conn = (Connection*)events[i].data.ptr;
+                if (!conn) {
+                    acceptAll();
+                } else if (serve(conn)) {
+                    rearm(conn->fd, conn);
+                } else {
+                    closeConnection(conn);
+                }
+            }
+        }
+    }
+
+    static bool fail(const std::string& what) {
+        std::string message = what + ": " + strerror(errno) + "\n";
+        ssize_t ignored = write(STDERR_FILENO, message.data(), message.size());
+        (void)ignored;
+        return false;
+    }
+
+public:
+    explicit SocketServer(Handler& h) : handler(h), listenFd(-1), epollFd(-1) {}
+
+    ~SocketServer() {
+        for (Connection* conn : std::vector<Connection*>(connections.begin(), connections.end())) {
+            closeConnection(conn);
+        }
+        if (epollFd >= 0) ::close(epollFd);
+        if (listenFd >= 0) ::close(listenFd);
+    }
+
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+
+    // `address` is "unix:PATH" or a TCP port on the loopback interface
+    bool listenOn(const std::string& address) {
+        if (address.compare(0, 5, "unix:") == 0) {
+            std::string path = address.substr(5);
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return fail(address);
+            }
+            memcpy(addr.sun_path, path.data(), path.size());
+            unlink(path.c_str());
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+                return fail(address);
+            }
+        } else {
+            char* end;
+            long port = strtol(address.c_str(), &end, 10);
+            if (address.empty() || *end != '\0' || port <= 0 || port > 65535) {
+                errno = EINVAL;
+                return fail(address);
+            }
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+            int one = 1;
+            if (listenFd < 0 || setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+                || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+                return fail(address);
+            }
+        }
+        if (listen(listenFd, SOMAXCONN) < 0) return fail(address);
+
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) return fail("epoll");
+        epoll_event ev;
+        ev.events = EPOLLIN | EPOLLONESHOT;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        return true;
+    }
+
+    // Serves connections on `threads` workers until SIGINT or SIGTERM
+    void run(size_t threads) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = requestServerStop;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        signal(SIGPIPE, SIG_IGN);
+
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < threads; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+        work();
+        for (auto& worker : workers) worker.join();
+    }
+};
+
+#endif
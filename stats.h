@@ -0,0 +1,215 @@
+#ifndef BOOKSTORE_STATS_H
+#define BOOKSTORE_STATS_H
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Build with -DBOOKSTORE_STATS=0 to compile the recording out
+#ifndef BOOKSTORE_STATS
+#define BOOKSTORE_STATS 1
+#endif
+
+// ==================== Latency Histogram ====================
+
+// Log-linear buckets in the style of HdrHistogram: values below 2^SUB_BITS
+// get a bucket each, and every power of two above that is split into
+// 2^SUB_BITS equal buckets, so a bucket is within 1/16 of its values.
+class LatencyHistogram {
+public:
+    static const unsigned SUB_BITS = 4;
+    static const size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS];
+
+public:
+    LatencyHistogram() {
+        for (auto& c : counts) c.store(0, std::memory_order_relaxed);
+    }
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < SUB_BUCKETS) return value;
+        unsigned exponent = 63 - __builtin_clzll(value);
+        unsigned shift = exponent - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that lands in `bucket`
+    static uint64_t highestIn(size_t bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        unsigned shift = bucket / SUB_BUCKETS - 1;
+        uint64_t low = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+    void record(uint64_t value) {
+        counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t count(size_t bucket) const {
+        return counts[bucket].load(std::memory_order_relaxed);
+    }
+};
+
+// ==================== Command Stats ====================
+
+// Per-command counts and latencies. Latencies are kept in CPU timestamp
+// ticks, which cost a few cycles to read, and converted to time only when
+// reported, against the steady clock over the same period. With
+// BOOKSTORE_STATS off every member is a no-op the compiler removes.
+template <size_t COMMANDS>
+class CommandStats {
+public:
+    static constexpr bool ENABLED = BOOKSTORE_STATS != 0;
+
+private:
+    struct PerCommand {
+        LatencyHistogram latency;
+        std::atomic<uint64_t> totalTicks{0};
+        std::atomic<uint64_t> failures{0};
+    };
+
+    PerCommand commands[ENABLED ? COMMANDS : 1];
+    uint64_t startTicks;
+    std::chrono::steady_clock::time_point startTime;
+
+    double nanosPerTick() const {
+        double nanos = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+        uint64_t ticks = now() - startTicks;
+        return ticks > 0 ? nanos / ticks : 1.0;
+    }
+
+public:
+    CommandStats() : startTicks(now()), startTime(std::chrono::steady_clock::now()) {}
+
+    CommandStats(const CommandStats&) = delete;
+    CommandStats& operator=(const CommandStats&) = delete;
+
+    static uint64_t now() {
+        if (!ENABLED) return 0;
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void record(size_t command, uint64_t ticks, bool success) {
+        if (!ENABLED) return;
+        PerCommand& c = commands[command];
+        c.latency.record(ticks);
+        c.totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+        if (!success) c.failures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // One line per command that ran: count, failures, then mean and
+    // percentiles in microseconds
+    void format(std::string& out, const std::string_view names[]) const {
+        if (!ENABLED) return;
+        double micros = nanosPerTick() / 1000;
+        char line[160];
+        snprintf(line, sizeof(line), "%-10s %10s %8s %10s %10s %10s %10s %10s\n",
+                 "command", "count", "invalid", "mean(us)", "p50", "p90", "p99", "max");
+        out += line;
+        for (size_t i = 0; i < COMMANDS; i++) {
+            const PerCommand& c = commands[i];
+            uint64_t counts[LatencyHistogram::BUCKETS];
+            uint64_t total = 0;
+            for (size_t b = 0; b < LatencyHistogram::BUCKETS; b++) {
+                counts[b] = c.latency.count(b);
+                total += counts[b];
+            }
+            if (total == 0) continue;
+
+            // Highest value of the bucket holding each quantile
+            const double quantiles[] = {0.5, 0.9, 0.99, 1.0};
+            double values[4];
+            uint64_t seen = 0;
+            size_t q = 0;
+            for (size_t b = 0; b < LatencyHistogram::BUCKETS && q < 4; b++) {
+                seen += counts[b];
+                while (q < 4 && seen >= quantiles[q] * total) {
+                    values[q++] = LatencyHistogram::highestIn(b) * micros;
+                }
+            }
+            std::string_view name = names[i].empty() ? std::string_view("(invalid)") : names[i];
+            snprintf(line, sizeof(line), "%-10.*s %10llu %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                     (int)name.size(), name.data(), (unsigned long long)total,
+                     (unsigned long long)c.failures.load(std::memory_order_relaxed),
+                     c.totalTicks.load(std::memory_order_relaxed) * micros / total,
+                     values[0], values[1], values[2], values[3]);
+            out += line;
+        }
+    }
+};
+
+// ==================== Metrics File ====================
+
+// Rewrites a file with fresh text every few seconds from a background
+// thread, and once more when stopped. Readers see either the old or the new
+// contents: each version is written to a temporary file and renamed.
+class MetricsWriter {
+private:
+    std::string path;
+    std::chrono::seconds interval;
+    std::function<std::string()> produce;
+    std::mutex latch;
+    std::condition_variable wake;
+    bool stopping;
+    std::thread worker;
+
+    void writeOnce() {
+        std::string text = produce();
+        std::string temporary = path + ".tmp";
+        FILE* f = fopen(temporary.c_str(), "w");
+        if (!f) return;
+        fwrite(text.data(), 1, text.size(), f);
+        fclose(f);
+        rename(temporary.c_str(), path.c_str());
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(latch);
+        bool last = false;
+        while (!last) {
+            wake.wait_for(lock, interval, [this] { return stopping; });
+            last = stopping;
+            lock.unlock();
+            writeOnce();
+            lock.lock();
+        }
+    }
+
+public:
+    MetricsWriter(const std::string& p, unsigned seconds, std::function<std::string()> f)
+        : path(p), interval(seconds), produce(std::move(f)), stopping(false),
+          worker([this] { run(); }) {}
+
+    ~MetricsWriter() {
+        {
+            std::lock_guard<std::mutex> lock(latch);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+};
+
+#endif
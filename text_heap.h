@@ -0,0 +1,258 @@
+#ifndef BOOKSTORE_TEXT_HEAP_H
+#define BOOKSTORE_TEXT_HEAP_H
+
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include "paged_file.h"
+#include "buffer_pool.h"
+#include "free_space_map.h"
+
+// ==================== Text Heap ====================
+
+// Variable-length records in slotted pages, for data that is too long and
+// too rarely needed to sit next to the keys that own it. Each page starts
+// with an array of slots and packs record bytes from its end backwards; a
+// record is addressed by page and slot, which stay valid until it is
+// erased. New records go into the current fill page. Pages that erases
+// leave with plenty of room are remembered in the header and filled
+// next, and pages left empty go back to the free space map.
+//
+// Writers need the heap to themselves. Readers may run concurrently with
+// each other and take no page latches.
+class TextHeap {
+public:
+    // Where a record lives; page 0 is the header, so it means no record
+    struct Ref {
+        uint32_t page;
+        uint32_t slot;
+
+        Ref() : page(0), slot(0) {}
+
+        bool empty() const { return page == 0; }
+    };
+
+private:
+    static const uint32_t MAGIC = 0x31545854; // "TXT1"
+    static const uint32_t MAX_CANDIDATES = 16;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t fillPage; // 0 before the first record
+        uint32_t candidateCount;
+        uint32_t candidates[MAX_CANDIDATES]; // pages with room, besides the fill page
+        uint64_t records;
+        FreeSpaceMap::State freeSpace;
+    };
+
+    struct PageHeader {
+        uint16_t slots;     // length of the slot array
+        uint16_t liveSlots; // slots holding a record
+        uint16_t liveBytes; // bytes of those records
+        uint16_t dataStart; // first byte of record data
+    };
+
+    struct Slot {
+        uint16_t offset; // 0 while the slot is free
+        uint16_t length;
+    };
+
+    BufferPool& pool;
+    PagedFile file;
+    Header header;
+    FreeSpaceMap freeSpace;
+
+    void writeHeader() {
+        PageGuard page = pool.fetch(file, 0);
+        memcpy(page.data(), &header, sizeof(header));
+        page.markDirty();
+    }
+
+    static Slot* slotsOf(const PageGuard& page) {
+        return reinterpret_cast<Slot*>(page.data() + sizeof(PageHeader));
+    }
+
+    // Bytes a page could still take with its records packed together
+    static size_t roomIn(const PageHeader* h) {
+        return PAGE_SIZE - sizeof(PageHeader) - h->slots * sizeof(Slot) - h->liveBytes;
+    }
+
+    // Packs the records of a page against its end, leaving one gap
+    static void defragment(PageGuard& page) {
+        char copy[PAGE_SIZE];
+        memcpy(copy, page.data(), PAGE_SIZE);
+        PageHeader* h = page.as<PageHeader>();
+        Slot* slots = slotsOf(page);
+        size_t end = PAGE_SIZE;
+        for (uint32_t i = 0; i < h->slots; i++) {
+            if (slots[i].offset == 0) continue;
+            end -= slots[i].length;
+            memcpy(page.data() + end, copy + slots[i].offset, slots[i].length);
+            slots[i].offset = end;
+        }
+        h->dataStart = end;
+    }
+
+    // Stores a record in `pageId` if it fits there
+    bool place(uint32_t pageId, const char* bytes, size_t length, Ref& ref) {
+        PageGuard page = pool.fetch(file, pageId);
+        PageHeader* h = page.as<PageHeader>();
+        Slot* slots = slotsOf(page);
+        uint32_t slot = 0;
+        while (slot < h->slots && slots[slot].offset != 0) slot++;
+        size_t slotEnd = sizeof(PageHeader) + (slot == h->slots ? slot + 1 : h->slots) * sizeof(Slot);
+        if (slotEnd + h->liveBytes + length > PAGE_SIZE) return false;
+        if (slotEnd + length > h->dataStart) defragment(page);
+        h->dataStart -= length;
+        memcpy(page.data() + h->dataStart, bytes, length);
+        if (slot == h->slots) h->slots++;
+        slots[slot].offset = h->dataStart;
+        slots[slot].length = length;
+        h->liveSlots++;
+        h->liveBytes += length;
+        page.markDirty();
+        ref.page = pageId;
+        ref.slot = slot;
+        return true;
+    }
+
+    void rememberCandidate(uint32_t pageId) {
+        for (uint32_t i = 0; i < header.candidateCount; i++) {
+            if (header.candidates[i] == pageId) return;
+        }
+        if (header.candidateCount < MAX_CANDIDATES) header.candidates[header.candidateCount++] = pageId;
+    }
+
+    void forgetCandidate(uint32_t pageId) {
+        for (uint32_t i = 0; i < header.candidateCount; i++) {
+            if (header.candidates[i] == pageId) {
+                header.candidates[i] = header.candidates[--header.candidateCount];
+                return;
+            }
+        }
+    }
+
+public:
+    // Longest record a page can hold
+    static const size_t MAX_RECORD = PAGE_SIZE - sizeof(PageHeader) - sizeof(Slot);
+
+    TextHeap(BufferPool& bufferPool, const std::string& path)
+        : pool(bufferPool), file(path), freeSpace(pool, file, header.freeSpace) {
+        if (file.pageCount() == 0) {
+            pool.allocate(file);
+        }
+        memcpy(&header, pool.fetch(file, 0).data(), sizeof(header));
+        if (!checkFormat(&header, MAGIC, path)) {
+            memset(&header, 0, sizeof(header));
+            header.magic = MAGIC;
+            header.version = FORMAT_VERSION;
+            writeHeader();
+        }
+    }
+
+    uint64_t size() const {
+        return header.records;
+    }
+
+    // Stores `length` bytes; an empty record gets an empty Ref
+    Ref insert(const char* bytes, size_t length) {
+        Ref ref;
+        if (length == 0) return ref;
+        if (header.fillPage == 0 || !place(header.fillPage, bytes, length, ref)) {
+            // Candidates that turn out too full are dropped until erases
+            // free more of them
+            header.fillPage = 0;
+            while (header.candidateCount > 0) {
+                uint32_t pageId = header.candidates[--header.candidateCount];
+                if (place(pageId, bytes, length, ref)) {
+                    header.fillPage = pageId;
+                    break;
+                }
+            }
+            if (header.fillPage == 0) {
+                PageGuard page = freeSpace.allocate();
+                page.as<PageHeader>()->dataStart = PAGE_SIZE;
+                page.markDirty();
+                header.fillPage = page.pageId();
+                page.release();
+                place(header.fillPage, bytes, length, ref);
+            }
+        }
+        header.records++;
+        writeHeader();
+        return ref;
+    }
+
+    // Copies a record into `out`, which must be large enough for it;
+    // returns its length
+    size_t read(const Ref& ref, char* out) {
+        if (ref.empty()) return 0;
+        PageGuard page = pool.fetch(file, ref.page);
+        const Slot& slot = slotsOf(page)[ref.slot];
+        memcpy(out, page.data() + slot.offset, slot.length);
+        return slot.length;
+    }
+
+    // Reads many records in a row, keeping the last few pages it touched
+    // pinned (one per page id modulo PAGES), so a small heap is fetched
+    // once per cursor rather than once per record. Records are returned in
+    // place, valid until the next read; same rules as read() otherwise.
+    class Cursor {
+    private:
+        static const uint32_t PAGES = 8;
+
+        TextHeap& heap;
+        PageGuard pages[PAGES];
+
+    public:
+        explicit Cursor(TextHeap& h) : heap(h) {}
+
+        std::string_view read(const Ref& ref) {
+            if (ref.empty()) return std::string_view();
+            PageGuard& page = pages[ref.page % PAGES];
+            if (!page.data() || page.pageId() != ref.page) page = heap.pool.fetch(heap.file, ref.page);
+            const Slot& slot = slotsOf(page)[ref.slot];
+            return std::string_view(page.data() + slot.offset, slot.length);
+        }
+    };
+
+    void erase(const Ref& ref) {
+        if (ref.empty()) return;
+        PageGuard page = pool.fetch(file, ref.page);
+        PageHeader* h = page.as<PageHeader>();
+        Slot* slots = slotsOf(page);
+        h->liveSlots--;
+        h->liveBytes -= slots[ref.slot].length;
+        slots[ref.slot].offset = 0;
+        slots[ref.slot].length = 0;
+        while (h->slots > 0 && slots[h->slots - 1].offset == 0) h->slots--;
+        if (h->liveSlots == 0) h->dataStart = PAGE_SIZE;
+        page.markDirty();
+        bool empty = h->liveSlots == 0;
+        bool roomy = roomIn(h) >= PAGE_SIZE / 4;
+        page.release();
+
+        if (ref.page != header.fillPage) {
+            if (empty) {
+                forgetCandidate(ref.page);
+                freeSpace.release(ref.page);
+            } else if (roomy) {
+                rememberCandidate(ref.page);
+            }
+        }
+        header.records--;
+        writeHeader();
+    }
+
+    // Gives trailing free pages back to the file system; see
+    // FreeSpaceMap::trimTail
+    bool trimFreeTail() {
+        if (!freeSpace.trimTail()) return false;
+        writeHeader();
+        return true;
+    }
+};
+
+#endif
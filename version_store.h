@@ -0,0 +1,183 @@
+#ifndef BOOKSTORE_VERSION_STORE_H
+#define BOOKSTORE_VERSION_STORE_H
+
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+#include <cstdint>
+#include "arena.h"
+
+// ==================== Snapshots ====================
+
+// What a reader sees: every command committed up to `seq`, which is also
+// the first `ledgerSize` ledger entries and `logSize` log records
+struct Snapshot {
+    uint64_t seq;
+    uint64_t ledgerSize;
+    uint64_t logSize;
+
+    Snapshot() : seq(0), ledgerSize(0), logSize(0) {}
+};
+
+// Hands out snapshots of the last published commit and keeps track of the
+// ones still in use, so that versions older than all of them can go
+class SnapshotRegistry {
+private:
+    std::mutex latch;
+    Snapshot current;
+    std::vector<uint64_t> active; // one per open snapshot, in no order
+
+public:
+    // Called by the commit leader once a command is fully applied
+    void publish(const Snapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(latch);
+        current = snapshot;
+    }
+
+    Snapshot acquire() {
+        std::lock_guard<std::mutex> lock(latch);
+        active.push_back(current.seq);
+        return current;
+    }
+
+    void release(const Snapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(latch);
+        auto it = std::find(active.begin(), active.end(), snapshot.seq);
+        *it = active.back();
+        active.pop_back();
+    }
+
+    // Oldest commit any present or future reader can ask for
+    uint64_t horizon() {
+        std::lock_guard<std::mutex> lock(latch);
+        return active.empty() ? current.seq : *std::min_element(active.begin(), active.end());
+    }
+};
+
+// Holds a snapshot for as long as it is alive
+class SnapshotGuard {
+private:
+    SnapshotRegistry& registry;
+    Snapshot snapshot;
+
+public:
+    explicit SnapshotGuard(SnapshotRegistry& r) : registry(r), snapshot(r.acquire()) {}
+
+    ~SnapshotGuard() {
+        registry.release(snapshot);
+    }
+
+    SnapshotGuard(const SnapshotGuard&) = delete;
+    SnapshotGuard& operator=(const SnapshotGuard&) = delete;
+
+    const Snapshot& get() const { return snapshot; }
+    const Snapshot* operator->() const { return &snapshot; }
+};
+
+// ==================== Version Store ====================
+
+// Before-images of records whose live copy changed after some snapshot
+// was taken. A writer saves the old state (or its absence) before it
+// changes a record, and the commit leader stamps the version with the
+// sequence number of the command that superseded it. A reader at snapshot
+// s reads the live record first and then asks for a version: the oldest
+// one stamped after s (or not stamped yet) is what it should see instead.
+//
+// Writes to one key must commit in the order they were made, which keeps
+// each key's versions ordered by stamp. Versions come and go with every
+// write, so their containers draw on a node pool rather than the heap.
+template <class Key, class Value>
+class VersionStore {
+public:
+    static const uint64_t PENDING = UINT64_MAX;
+
+private:
+    struct Version {
+        uint64_t until; // sequence number of the superseding commit
+        bool present;
+        Value value;
+    };
+
+    typedef std::deque<Version, PoolAllocator<Version>> History;
+    typedef std::pair<const Key, History> Entry;
+    typedef std::pair<uint64_t, Key> Stamp;
+
+    std::mutex latch;
+    NodePool nodes; // must outlive the containers below
+    std::map<Key, History, std::less<Key>, PoolAllocator<Entry>> versions; // per key, oldest first
+    std::deque<Stamp, PoolAllocator<Stamp>> stamped; // in stamp order
+
+public:
+    VersionStore()
+        : versions(std::less<Key>(), PoolAllocator<Entry>(nodes)),
+          stamped(PoolAllocator<Stamp>(nodes)) {}
+
+    void save(const Key& key, bool present, const Value& before) {
+        std::lock_guard<std::mutex> lock(latch);
+        auto it = versions.try_emplace(key, PoolAllocator<Version>(nodes)).first;
+        it->second.push_back(Version{PENDING, present, before});
+    }
+
+    // Stamps the oldest unstamped version of `key`
+    void stamp(const Key& key, uint64_t seq) {
+        std::lock_guard<std::mutex> lock(latch);
+        auto it = versions.find(key);
+        if (it == versions.end()) return;
+        // Pending versions of a key commit in the order they were saved
+        for (auto& v : it->second) {
+            if (v.until == PENDING) {
+                v.until = seq;
+                stamped.push_back(std::make_pair(seq, key));
+                return;
+            }
+        }
+    }
+
+    // Looks up the state of `key` at snapshot `seq`; returns false when the
+    // live record is the right one
+    bool find(const Key& key, uint64_t seq, bool& present, Value& value) {
+        std::lock_guard<std::mutex> lock(latch);
+        auto it = versions.find(key);
+        if (it == versions.end()) return false;
+        for (const auto& v : it->second) {
+            if (v.until > seq) {
+                present = v.present;
+                value = v.value;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Appends the keys with versions in (from, to], or (from, end) when
+    // `to` is null, to `result`; `from` is included when `inclusive` is set
+    template <class Keys>
+    void keys(const Key& from, bool inclusive, const Key* to, Keys& result) {
+        std::lock_guard<std::mutex> lock(latch);
+        auto it = inclusive ? versions.lower_bound(from) : versions.upper_bound(from);
+        for (; it != versions.end() && (!to || !(*to < it->first)); ++it) {
+            result.push_back(it->first);
+        }
+    }
+
+    template <class Keys>
+    void allKeys(Keys& result) {
+        std::lock_guard<std::mutex> lock(latch);
+        for (const auto& entry : versions) result.push_back(entry.first);
+    }
+
+    // Drops the versions no snapshot at or after `horizon` can need
+    void collect(uint64_t horizon) {
+        std::lock_guard<std::mutex> lock(latch);
+        while (!stamped.empty() && stamped.front().first <= horizon) {
+            auto it = versions.find(stamped.front().second);
+            it->second.pop_front();
+            if (it->second.empty()) versions.erase(it);
+            stamped.pop_front();
+        }
+    }
+};
+
+#endif
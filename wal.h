@@ -0,0 +1,343 @@
+#ifndef BOOKSTORE_WAL_H
+#define BOOKSTORE_WAL_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include "paged_file.h"
+#include "buffer_pool.h"
+
+// ==================== Write-Ahead Log ====================
+
+// Append-only redo log. Every mutating command appends one opaque redo
+// record and hands it to the OS when it commits; fdatasync runs once per
+// group of commits, or sooner when a reply that depends on one is about
+// to be sent (waitDurable), and concurrent callers share it.
+// Records between beginBatch() and endBatch() form one atomic unit that
+// is made durable by a single fdatasync; recovery drops a batch whose end
+// marker never reached the log.
+//
+// A checkpoint first appends an image of every dirty page followed by an
+// end marker and syncs the log, then writes the pages in place and
+// truncates the log. The buffer pool never writes pages otherwise, except
+// when a long batch spills (see spill()), which logs the pages' previous
+// images first. Recovery therefore always starts from data files at a
+// checkpoint boundary:
+//   - crash before the end marker is durable: spilled pages are put back
+//     from their undo images, and every redo record in the log is replayed;
+//   - crash after it: the page images are reapplied (idempotent) and only
+//     redo records logged after the marker are replayed.
+class WriteAheadLog {
+private:
+    enum RecordType : uint32_t {
+        REDO = 1,
+        PAGE_IMAGE = 2,
+        CHECKPOINT_END = 3,
+        BATCH_BEGIN = 4,
+        BATCH_END = 5,
+        UNDO_IMAGE = 6,  // a page as it was at the last checkpoint
+        UNDO_LENGTH = 7  // a file's length at the last checkpoint
+    };
+
+    struct RecordHeader {
+        uint32_t type;
+        uint32_t length;
+        uint32_t checksum;
+        uint32_t reserved;
+    };
+
+    struct PageImage {
+        char path[64];
+        uint32_t pageId;
+        uint32_t reserved;
+        char data[PAGE_SIZE];
+    };
+
+    struct FileLength {
+        char path[64];
+        uint64_t bytes;
+    };
+
+    int fd;
+    std::string buffer;       // records not yet handed to the OS
+    size_t groupSize;
+    std::atomic<size_t> pendingCommits; // commits since the last fdatasync
+    bool batching;
+    uint64_t bytes;           // log size, buffered records included
+    // Bytes ever handed to the OS, and how many of those are durable;
+    // both keep counting across truncations
+    std::atomic<uint64_t> writtenBytes;
+    std::atomic<uint64_t> durableBytes;
+    std::mutex syncMutex;     // one fdatasync at a time
+    // What spill() has logged undo for since the last checkpoint: pages by
+    // file id and page id, and file lengths by file id
+    std::unordered_set<uint64_t> undonePages;
+    std::unordered_map<uint32_t, uint64_t> undoneLengths;
+    std::vector<std::string> recovered;
+
+    static uint32_t checksum(uint32_t type, const char* data, size_t length) {
+        uint32_t h = 2166136261u ^ type;
+        for (size_t i = 0; i < length; i++) {
+            h = (h ^ (unsigned char)data[i]) * 16777619u;
+        }
+        return h;
+    }
+
+    void appendRecord(uint32_t type, const void* payload, size_t length) {
+        RecordHeader header;
+        header.type = type;
+        header.length = length;
+        header.checksum = checksum(type, (const char*)payload, length);
+        header.reserved = 0;
+        buffer.append((const char*)&header, sizeof(header));
+        buffer.append((const char*)payload, length);
+        bytes += sizeof(header) + length;
+    }
+
+    void writeBuffer() {
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + done, buffer.size() - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        writtenBytes += buffer.size();
+        buffer.clear();
+    }
+
+    static void restoreImage(const PageImage& image) {
+        int file = open(image.path, O_RDWR | O_CREAT, 0644);
+        pwrite(file, image.data, PAGE_SIZE, (off_t)image.pageId * PAGE_SIZE);
+        fdatasync(file);
+        close(file);
+    }
+
+    static void restoreLength(const FileLength& length) {
+        int file = open(length.path, O_RDWR | O_CREAT, 0644);
+        ftruncate(file, length.bytes);
+        fdatasync(file);
+        close(file);
+    }
+
+    static void copyPath(char (&out)[64], const std::string& path) {
+        memset(out, 0, sizeof(out));
+        strncpy(out, path.c_str(), sizeof(out) - 1);
+    }
+
+    // Reapplies the page images of the last complete checkpoint and keeps
+    // the redo records that follow it for the owner to replay. Parsing
+    // stops at the first torn or corrupt record.
+    void recover() {
+        std::string log;
+        char chunk[1 << 16];
+        ssize_t n;
+        while ((n = pread(fd, chunk, sizeof(chunk), log.size())) > 0) {
+            log.append(chunk, n);
+        }
+
+        struct Entry {
+            uint32_t type;
+            size_t offset;
+            size_t length;
+        };
+        std::vector<Entry> entries;
+        size_t pos = 0;
+        int lastEnd = -1;
+        while (pos + sizeof(RecordHeader) <= log.size()) {
+            RecordHeader header;
+            memcpy(&header, log.data() + pos, sizeof(header));
+            size_t start = pos + sizeof(header);
+            if (start + header.length > log.size()) break;
+            if (checksum(header.type, log.data() + start, header.length) != header.checksum) break;
+            if (header.type == CHECKPOINT_END) lastEnd = entries.size();
+            entries.push_back({header.type, start, header.length});
+            pos = start + header.length;
+        }
+
+        int openBatch = -1;
+        size_t batchRecords = 0;
+        std::vector<const FileLength*> lengths;
+        for (int i = 0; i < (int)entries.size(); i++) {
+            const Entry& e = entries[i];
+            if (i < lastEnd && e.type == PAGE_IMAGE && e.length == sizeof(PageImage)) {
+                restoreImage(*reinterpret_cast<const PageImage*>(log.data() + e.offset));
+            } else if (i > lastEnd && e.type == UNDO_IMAGE && e.length == sizeof(PageImage)) {
+                restoreImage(*reinterpret_cast<const PageImage*>(log.data() + e.offset));
+            } else if (i > lastEnd && e.type == UNDO_LENGTH && e.length == sizeof(FileLength)) {
+                lengths.push_back(reinterpret_cast<const FileLength*>(log.data() + e.offset));
+            } else if (i > lastEnd && e.type == REDO) {
+                recovered.push_back(log.substr(e.offset, e.length));
+            } else if (i > lastEnd && e.type == BATCH_BEGIN) {
+                openBatch = i;
+                batchRecords = recovered.size();
+            } else if (i > lastEnd && e.type == BATCH_END) {
+                openBatch = -1;
+            }
+        }
+        // Pages spilled past the old ends go with the rest of the batch's
+        // writes; the redo records rebuild whatever committed
+        for (const FileLength* length : lengths) {
+            restoreLength(*length);
+        }
+        if (openBatch >= 0) {
+            // The batch never committed: forget it and everything after it
+            recovered.resize(batchRecords);
+            pos = entries[openBatch].offset - sizeof(RecordHeader);
+        }
+
+        // Drop any torn tail so new records follow the last valid one
+        if (pos < log.size()) ftruncate(fd, pos);
+        bytes = pos;
+    }
+
+public:
+    WriteAheadLog(const std::string& path, size_t groupCommitSize)
+        : groupSize(groupCommitSize), pendingCommits(0), batching(false), bytes(0), writtenBytes(0),
+          durableBytes(0) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        recover();
+    }
+
+    ~WriteAheadLog() {
+        sync();
+        close(fd);
+    }
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Redo records found at startup that still have to be replayed
+    std::vector<std::string> takeRecovered() {
+        std::vector<std::string> result;
+        result.swap(recovered);
+        return result;
+    }
+
+    void logRedo(const void* payload, size_t length) {
+        appendRecord(REDO, payload, length);
+        // Long batches hand records to the OS early, without syncing
+        if (buffer.size() >= (1 << 20)) writeBuffer();
+    }
+
+    // Marks the end of one command and hands its records to the OS; every
+    // groupSize commands they are made durable with a single fdatasync
+    void commit() {
+        if (buffer.empty() || batching) return;
+        writeBuffer();
+        if (++pendingCommits >= groupSize) sync();
+    }
+
+    // Log position just past everything handed to the OS so far
+    uint64_t written() const {
+        return writtenBytes;
+    }
+
+    // Returns once the log is durable up to `position`. Any thread may
+    // call it; one that arrives while another syncs waits for that sync
+    // and is usually covered by it.
+    void waitDurable(uint64_t position) {
+        if (durableBytes >= position) return;
+        std::lock_guard<std::mutex> lock(syncMutex);
+        if (durableBytes >= position) return;
+        uint64_t target = writtenBytes;
+        pendingCommits = 0;
+        fdatasync(fd);
+        durableBytes = target;
+    }
+
+    void beginBatch() {
+        sync();
+        appendRecord(BATCH_BEGIN, nullptr, 0);
+        batching = true;
+    }
+
+    // Commits the batch with one fdatasync
+    void endBatch() {
+        appendRecord(BATCH_END, nullptr, 0);
+        batching = false;
+        sync();
+    }
+
+    bool inBatch() const {
+        return batching;
+    }
+
+    void sync() {
+        writeBuffer();
+        waitDurable(writtenBytes);
+    }
+
+    uint64_t size() const {
+        return bytes;
+    }
+
+    // Makes room in the pool during a batch by writing its dirty pages in
+    // place early. The first time a page is overwritten after a
+    // checkpoint, its image on disk is logged first, and so is the length
+    // of its file, which covers pages the file does not have yet. Recovery
+    // puts these back before replaying, whether or not the batch got to
+    // commit, and the log keeps them until the next checkpoint. Needs the
+    // data files to itself, like checkpoint().
+    void spill(BufferPool& pool) {
+        pool.forEachDirty([&](PagedFile& file, uint32_t pageId, const char*) {
+            auto length = undoneLengths.find(file.fileId());
+            if (length == undoneLengths.end()) {
+                FileLength record;
+                copyPath(record.path, file.path());
+                record.bytes = file.size();
+                appendRecord(UNDO_LENGTH, &record, sizeof(record));
+                length = undoneLengths.emplace(file.fileId(), file.size()).first;
+            }
+            if ((uint64_t)pageId * PAGE_SIZE >= length->second) return;
+            if (!undonePages.insert(((uint64_t)file.fileId() << 32) | pageId).second) return;
+            PageImage image;
+            copyPath(image.path, file.path());
+            image.pageId = pageId;
+            image.reserved = 0;
+            file.read(pageId, image.data);
+            appendRecord(UNDO_IMAGE, &image, sizeof(image));
+            if (buffer.size() >= (1 << 20)) writeBuffer();
+        });
+        sync();
+        pool.flush();
+    }
+
+    // Folds the log into the data files and truncates it
+    void checkpoint(BufferPool& pool) {
+        if (pool.dirtyPages() > 0) {
+            pool.forEachDirty([&](PagedFile& file, uint32_t pageId, const char* data) {
+                PageImage image;
+                copyPath(image.path, file.path());
+                image.pageId = pageId;
+                image.reserved = 0;
+                memcpy(image.data, data, PAGE_SIZE);
+                appendRecord(PAGE_IMAGE, &image, sizeof(image));
+                if (buffer.size() >= (1 << 20)) writeBuffer();
+            });
+            appendRecord(CHECKPOINT_END, nullptr, 0);
+            writeBuffer();
+            fdatasync(fd);
+            pool.flush();
+        } else {
+            buffer.clear();
+        }
+        ftruncate(fd, 0);
+        fdatasync(fd);
+        bytes = 0;
+        undonePages.clear();
+        undoneLengths.clear();
+        // Everything logged so far is in the data files now
+        std::lock_guard<std::mutex> lock(syncMutex);
+        pendingCommits = 0;
+        durableBytes = writtenBytes.load();
+    }
+};
+
+#endif